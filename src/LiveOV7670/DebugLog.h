@@ -0,0 +1,59 @@
+//
+// Tokenized debug messages.
+//
+// DEBUG_LOG("Resolution %u not available", resolution);
+//
+// Only a 16-bit id of the format string and the raw argument bytes are sent
+// (COMMAND_DEBUG_LOG). The id is the CRC-16 of the format string computed by
+// the compiler, so the string itself is not stored on the Arduino at all.
+// tools/debug_log_table.py finds the DEBUG_LOG calls in the sources and
+// generates the id to format string table for the host.
+//
+// Arguments are sent little endian with their own size, so the format must
+// match the argument types: %hhu/%hhd 8-bit, %u/%d/%x 16-bit, %lu/%ld/%lx 32-bit.
+//
+
+#ifndef _DEBUG_LOG_h_
+#define _DEBUG_LOG_h_
+
+#include "Arduino.h"
+
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), same as in debug_log_table.py
+constexpr uint16_t debugLogCrc16Bits(uint16_t crc, uint8_t bitCount) {
+  return bitCount == 0
+      ? crc
+      : debugLogCrc16Bits((crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF, bitCount - 1);
+}
+
+constexpr uint16_t debugLogCrc16(const char * text, uint16_t crc = 0xFFFF) {
+  return *text == 0
+      ? crc
+      : debugLogCrc16(text + 1, debugLogCrc16Bits(crc ^ ((uint16_t)(uint8_t)*text << 8), 8));
+}
+
+
+// Total size of the arguments in bytes
+template <typename... Arguments>
+struct DebugLogArgumentsLength;
+
+template <>
+struct DebugLogArgumentsLength<> {
+  static const uint8_t value = 0;
+};
+
+template <typename Argument, typename... Arguments>
+struct DebugLogArgumentsLength<Argument, Arguments...> {
+  static const uint8_t value = sizeof(Argument) + DebugLogArgumentsLength<Arguments...>::value;
+};
+
+
+// The id is a constant expression, so nothing of the format string is left in the program.
+#define DEBUG_LOG(format, ...) \
+    do { \
+      constexpr uint16_t debugLogId = debugLogCrc16(format); \
+      commandDebugLog(debugLogId, ##__VA_ARGS__); \
+    } while (0)
+
+
+#endif // _DEBUG_LOG_h_
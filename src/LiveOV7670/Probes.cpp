@@ -0,0 +1,42 @@
+//
+// Timing probes for the capture pipeline.
+//
+
+#include "Probes.h"
+
+#if PROBES_ENABLED
+
+
+ProbeStatistics probeStatistics[PROBE_COUNT];
+
+
+
+void probeRecord(ProbeId probe, uint32_t ticks) {
+  ProbeStatistics & statistics = probeStatistics[probe];
+  uint32_t micros = ticks / Timer1Scheduler::TICKS_PER_MICRO;
+
+  if (statistics.count == 0 || micros < statistics.minMicros) {
+    statistics.minMicros = micros;
+  }
+  if (micros > statistics.maxMicros) {
+    statistics.maxMicros = micros;
+  }
+  statistics.sumMicros += micros;
+  statistics.count++;
+
+  // Number of significant bits is the log2 bin
+  uint8_t bin = 0;
+  while (micros > 0 && bin < PROBE_HISTOGRAM_BINS - 1) {
+    micros >>= 1;
+    bin++;
+  }
+  statistics.histogram[bin]++;
+}
+
+
+void probeReset() {
+  memset(probeStatistics, 0, sizeof(probeStatistics));
+}
+
+
+#endif
@@ -0,0 +1,73 @@
+//
+// Timing probes for the capture pipeline.
+//
+// PROBE_START(PROBE_LINE_CAPTURE);
+// ...
+// PROBE_STOP(PROBE_LINE_CAPTURE);
+//
+// Each probe keeps the count, min, max and sum of its durations in
+// microseconds and a histogram with one bin per power of two. Time comes
+// from Timer1Scheduler::getTicks(). With interrupts disabled it counts the
+// Timer1 periods itself, so a stop never comes before its start even in a
+// frame that is captured with interrupts disabled for seconds. A section is
+// only timed exactly if it is shorter than one 20ms Timer1 period, which is
+// why the vertical padding is not timed.
+//
+// With PROBES_ENABLED 0 (default) the macros are empty and no RAM is used.
+// Enable with build_flags = -DPROBES_ENABLED=1 in platformio.ini.
+//
+
+#ifndef _PROBES_h_
+#define _PROBES_h_
+
+#include "Arduino.h"
+#include "Timer1Scheduler.h"
+
+
+#ifndef PROBES_ENABLED
+#define PROBES_ENABLED 0
+#endif
+
+// Bin n counts durations from 2^(n-1) to 2^n - 1 us, the last bin everything longer
+#define PROBE_HISTOGRAM_BINS 16
+
+
+enum ProbeId {
+  PROBE_VSYNC_WAIT,
+  PROBE_BLANKING_UPDATE, // Exposure control and queued register writes, must fit into the vertical blanking
+  PROBE_LINE_CAPTURE,
+  PROBE_LINE_DRAIN,
+  PROBE_COMMAND_SEND,
+  PROBE_LINE_CODING, // Selection, coding and send of a COMMAND_LUMA_LINE, must fit into the line gap
+  PROBE_COUNT
+};
+
+
+struct ProbeStatistics {
+  uint16_t count;
+  uint32_t minMicros;
+  uint32_t maxMicros;
+  uint32_t sumMicros;
+  uint16_t histogram[PROBE_HISTOGRAM_BINS];
+};
+
+
+#if PROBES_ENABLED
+
+extern ProbeStatistics probeStatistics[PROBE_COUNT];
+
+void probeRecord(ProbeId probe, uint32_t ticks);
+void probeReset();
+
+#define PROBE_START(probe) uint32_t probeStart_##probe = Timer1Scheduler::getTicks()
+#define PROBE_STOP(probe) probeRecord(probe, Timer1Scheduler::getTicks() - probeStart_##probe)
+
+#else
+
+#define PROBE_START(probe)
+#define PROBE_STOP(probe)
+
+#endif
+
+
+#endif // _PROBES_h_
@@ -2,11 +2,26 @@
 #include "setup.h"
 #if EXAMPLE == 3
 #include "Arduino.h"
-#include "PWMServo.h"
+#include "Timer1Scheduler.h"
+#include "DebugLog.h"
+#include "Probes.h"
 #include "CameraOV7670.h"
+#include "StripBufferedCameraOV7670.h"
+#include "CameraOV7670ExposureControl.h"
 #include "avr/io.h"
 #include "avr/interrupt.h"
+#include "avr/pgmspace.h"
+#include "util/crc16.h"
 #define UART_MODE 2
+// 1 = exposure and white balance are controlled by the Arduino in the RGB modes (1, 2, 5, 6)
+// 0 = the camera's own AGC/AEC/AWB are used
+#define EXPOSURE_CONTROL 1
+// 2 = frames start with COMMAND_FRAME_HEADER (sequence number, vsync time, servo angle, exposure)
+// 1 = frames start with the short COMMAND_NEW_FRAME for older hosts
+#define FRAME_HEADER_VERSION 2
+// 1 = each line of the buffered RGB, Bayer and YUV modes is followed by COMMAND_LINE_CRC and each frame ends with COMMAND_FRAME_END
+// 0 = pixel data is only protected by the marker bits of the pixel formats
+#define UART_LINE_CRC 0
 
 
 /*
@@ -23,16 +38,36 @@ VERSION: This constant defines the system version (0x10 in this case).
 COMMAND_*: These constants represent commands used for UART communication:
 COMMAND_NEW_FRAME: Used by the commandStartNewFrame function to signal a new image frame.
 COMMAND_DEBUG_DATA: Used by the commandDebugPrint function to send debug messages.
+COMMAND_STATUS: Used by the commandStatus function to report whether the camera is working and how long the boot took.
+COMMAND_SET_ROI: Received from the host to select the region of interest (ROI) that is streamed.
+COMMAND_SET_RESOLUTION: Received from the host to switch between QQVGA and QVGA without resetting the camera.
 UART_PIXEL_FORMAT_RGB565: Specifies the RGB565 pixel format for UART transmission (5 bits red, 6 bits green, 5 bits blue).
+UART_PIXEL_FORMAT_BAYER8: Raw Bayer data, one byte per pixel. Lines alternate B G B G ... and G R G R ... starting with the first camera line.
+The host does the demosaic, which halves the link bytes per pixel compared to RGB565.
+UART_PIXEL_FORMAT_YUV420: Even lines (counted from the top of the region of interest) are sent as Y U Y V, odd lines as Y only.
+The host uses the chroma of the line above for the odd lines. 12 bits per pixel instead of 16.
+UART_PIXEL_FORMAT_RGB332: One byte per pixel, RRRGGGBB. Black is sent as 0x01 since 0 is the command marker.
+UART_PIXEL_FORMAT_PALETTE4: Two pixels per byte, first pixel in the high nibble. The value is an index into a 16 color palette
+that the host computes from recent frames. The host uploads the RGB332 to index map with COMMAND_SET_PALETTE_MAP.
+Index 0 is reserved (so a byte is never 0), which leaves 15 colors.
+UART_PIXEL_FORMAT_LUMA_CODED: Grayscale (Y) frame where every line is a COMMAND_LUMA_LINE packet, see commandLumaLine.
+UART_PIXEL_FORMAT_BTC: Lossy grayscale frame in 4x4 blocks, sent as COMMAND_BTC_BLOCKS packets, see encodeBtcStrip.
+UART_PIXEL_FORMAT_EDGES: 1 bit per pixel Sobel edge map, sent as COMMAND_PACKED_LINE packets, see commandEdgeLine.
+UART_PIXEL_FORMAT_BLOBS: No pixels, only a COMMAND_BLOBS packet at the end of the frame, see commandBlobs.
+On request (COMMAND_REQUEST_PIXELS) the grayscale lines of the frame are also sent as raw COMMAND_LUMA_LINE packets.
+UART_PIXEL_FORMAT_PROFILES: No pixels, only the row and column luma sums of the frame as COMMAND_PROFILE packets, see commandProfile.
+COMMAND_REQUEST_PIXELS: Received from the host. One byte: number of frames to send with pixels.
+UART_PIXEL_FORMAT_DITHER1, UART_PIXEL_FORMAT_DITHER2: Luma with a 4x4 ordered dither, 1 or 2 bits per pixel,
+sent as COMMAND_PACKED_LINE packets, see processDitherFrame.
+COMMAND_SET_THRESHOLD: Received from the host. 16-bit little endian threshold for the analysis modes (edge magnitude).
+COMMAND_SET_PALETTE_MAP: Received from the host. Offset into the map and up to 32 map bytes. Map byte k holds the indexes of
+RGB332 colors 2k (high nibble) and 2k+1 (low nibble).
 H_BYTE_* and L_BYTE_*: Constants related to pixel byte parity checking:
 H_BYTE_PARITY_CHECK: Bit mask to check for an odd number of bits in the high byte (red and green components).
 H_BYTE_PARITY_INVERT: Inverts the parity check result for the high byte.
 L_BYTE_PARITY_CHECK: Similar to H_BYTE for even parity in the low byte (green and blue).
 L_BYTE_PARITY_INVERT: Inverts the parity check result for the low byte.
 L_BYTE_PREVENT_ZERO: Ensures the low byte value is always above zero (avoiding issues with zero as an end-of-line marker) by setting the least significant bit.
-COLOR_*: Hexadecimal values representing colors:
-COLOR_GREEN: Green color value.
-COLOR_RED: Red color value.
 
 Function Prototypes:
 processRgbFrameBuffered and processRgbFrameDirect: Function prototypes (declarations without implementation) for processing RGB frames. The actual implementation is likely defined elsewhere.
@@ -40,12 +75,12 @@ ProcessFrameData: This is a function pointer type that can point to either proce
 commandStartNewFrame(uint8_t pixelFormat): Prototype for sending a "new frame" command with the specified pixel format over UART.
 commandDebugPrint(const String debugText): Prototype for sending a debug message over UART.
 sendNextCommandByte(uint8_t checksum, uint8_t commandByte): Prototype for sending a command byte and updating the checksum for error detection.
-sendBlankFrame(uint16_t color): Prototype for sending a blank frame filled with a specified color value.
+commandStatus(...): Prototype for sending the camera status and boot timing over UART.
 
 Configuration (Conditional Compilation):
 #if UART_MODE==1 and #endif: These define two conditional compilation blocks based on the value of UART_MODE.
 Each block sets various configuration options like:
-Image resolution (lineLength and lineCount).
+Image resolution (lineLength and lineCount). These follow the camera when the host switches the resolution.
 Baud rate (baud).
 Function pointer (processFrameData) to choose the frame processing function (likely processRgbFrameBuffered in this case).
 Line buffer size (lineBufferLength).
@@ -60,6 +95,9 @@ isLineBufferSendHighByte: Flag indicating if the current byte is the high byte o
 isLineBufferByteFormatted: Flag indicating if the current byte has been formatted for UART transmission.
 frameCounter: Counter for the number of processed frames.
 processedByteCountDuringCameraRead: Tracks the number of bytes processed during camera data reading.
+isCameraOk, cameraReadyMillis, isFirstFrameStarted: Boot status that is reported to the host with COMMAND_STATUS.
+roiX, roiY, roiWidth, roiHeight: The region of interest. Only pixels inside it are read and sent (full frame by default).
+hostCommand*: Receive buffer and parser state for commands coming from the host.
 
 Inline Function Prototypes:
 These functions are likely defined elsewhere with the inline keyword suggesting the compiler to inline them for efficiency. They handle low-level tasks related to:
@@ -74,7 +112,53 @@ Checking if the UART is ready for another byte transmission.
 const uint8_t VERSION = 0x10; //This constant is for defining version of the system
 const uint8_t COMMAND_NEW_FRAME = 0x01 | VERSION; // This constant is used in the commandStartNewFrame function
 const uint8_t COMMAND_DEBUG_DATA = 0x03 | VERSION; // This constant is used in the commandDebugPrint function
+const uint8_t COMMAND_STATUS = 0x06 | VERSION; // This constant is used in the commandStatus function
+const uint8_t COMMAND_SET_ROI = 0x04 | VERSION; // Host command: x, y, width, height as 16-bit little endian values
+const uint8_t COMMAND_SET_RESOLUTION = 0x05 | VERSION; // Host command: line length (160 or 320) as 16-bit little endian value
 const uint16_t UART_PIXEL_FORMAT_RGB565 = 0x01; // This constant specify the RGB565 format (5 = red, 6 = green, 5 = blue) 
+const uint16_t UART_PIXEL_FORMAT_BAYER8 = 0x02; // Raw Bayer, one byte per pixel, demosaic is done by the host
+const uint16_t UART_PIXEL_FORMAT_YUV420 = 0x03; // Y U Y V lines alternating with Y only lines
+const uint16_t UART_PIXEL_FORMAT_RGB332 = 0x04; // One byte per pixel, 3 bits red, 3 bits green, 2 bits blue
+const uint16_t UART_PIXEL_FORMAT_PALETTE4 = 0x05; // Two pixels per byte, 4-bit index into the host palette
+const uint8_t COMMAND_SET_PALETTE_MAP = 0x07 | VERSION; // Host command: map offset and up to 32 map bytes
+const uint16_t UART_PIXEL_FORMAT_LUMA_CODED = 0x06; // Lossless coded grayscale lines
+const uint8_t COMMAND_LUMA_LINE = 0x08 | VERSION; // One coded grayscale line, used by commandLumaLine
+const uint8_t LUMA_LINE_RAW = 0; // Coding byte values
+const uint8_t LUMA_LINE_RUN_LENGTH = 1;
+const uint8_t LUMA_LINE_LEFT = 2;
+const uint8_t LUMA_LINE_ABOVE = 3;
+const uint16_t UART_PIXEL_FORMAT_BTC = 0x07; // Block Truncation Coding, 2 bits per pixel
+const uint8_t COMMAND_BTC_BLOCKS = 0x09 | VERSION; // Up to 40 coded 4x4 blocks, used by encodeBtcStrip
+const uint16_t UART_PIXEL_FORMAT_EDGES = 0x08; // Sobel edge map, 1 bit per pixel
+const uint8_t COMMAND_PACKED_LINE = 0x0A | VERSION; // One line of 1 or 2 bit pixels (edge map, dither)
+const uint8_t COMMAND_SET_THRESHOLD = 0x0B | VERSION; // Host command: threshold as 16-bit little endian value
+const uint16_t UART_PIXEL_FORMAT_DITHER1 = 0x09; // Ordered dither, 1 bit per pixel
+const uint16_t UART_PIXEL_FORMAT_DITHER2 = 0x0A; // Ordered dither, 2 bits per pixel (4 gray levels)
+
+const uint16_t UART_PIXEL_FORMAT_BLOBS = 0x0B; // Bounding boxes, centroids and areas instead of pixels
+const uint8_t COMMAND_BLOBS = 0x0C | VERSION; // Blobs of one frame, used by commandBlobs
+const uint8_t COMMAND_REQUEST_PIXELS = 0x0D | VERSION; // Host command: number of frames to send with pixels
+const uint16_t UART_PIXEL_FORMAT_PROFILES = 0x0C; // Row and column projection profiles instead of pixels
+const uint8_t COMMAND_PROFILE = 0x0E | VERSION; // Part of a row or column profile, used by commandProfile
+const uint8_t PROFILE_ROWS = 0; // Profile ids in COMMAND_PROFILE
+const uint8_t PROFILE_COLUMNS = 1;
+const uint8_t COMMAND_SERVO_MOTION = 0x0F | VERSION; // Sent instead of a frame that is skipped while the servo moves or dwells
+const uint8_t COMMAND_PAGE_2 = 0x20; // Codes 0x00..0x0F with VERSION are all in use, new commands continue here
+const uint8_t COMMAND_SET_SCAN_SCHEDULE = 0x01 | COMMAND_PAGE_2; // Host command: first step index and up to 8 scan steps
+const uint8_t COMMAND_FRAME_HEADER = 0x02 | COMMAND_PAGE_2; // Fixed size frame header, replaces COMMAND_NEW_FRAME
+const uint8_t COMMAND_TELEMETRY = 0x03 | COMMAND_PAGE_2; // Telemetry counters, used by commandTelemetry
+const uint8_t COMMAND_DEBUG_LOG = 0x04 | COMMAND_PAGE_2; // Tokenized debug message, used by DEBUG_LOG
+const uint8_t COMMAND_PROBE = 0x05 | COMMAND_PAGE_2; // Timing statistics of one probe, used by commandProbe
+const uint8_t COMMAND_LINE_CRC = 0x06 | COMMAND_PAGE_2; // CRC-8 of the pixel bytes of one line, used by commandLineCrc
+const uint8_t COMMAND_FRAME_END = 0x07 | COMMAND_PAGE_2; // CRC-16 of the line CRCs of a frame, used by commandFrameEnd
+
+// 4x4 Bayer matrix as thresholds (16 * m + 8), indexed by [y & 3][x & 3]
+const uint8_t ditherMatrix[4][4] PROGMEM = {
+    {  8, 136,  40, 168},
+    {200,  72, 232, 104},
+    { 56, 184,  24, 152},
+    {248, 120, 216,  88}
+};
 
 // Pixel byte parity check:
 // Pixel Byte H: odd number of bits under H_BYTE_PARITY_CHECK and H_BYTE_PARITY_INVERT
@@ -90,49 +174,343 @@ const uint8_t L_BYTE_PARITY_INVERT = 0b00100000; // inverts the parity check res
 // Since the parity for L byte can reach zero, it must be ensured that it cannot reach zero
 // Increasing the lowest bit of blue color is fine for that.
 const uint8_t L_BYTE_PREVENT_ZERO  = 0b00000001; // This constant ensures that the total byte value is above zero by increaseing the lowest bit of blue color
-const uint16_t COLOR_GREEN = 0x07E0; // Hexadecimal for green
-const uint16_t COLOR_RED = 0xF800; // Hexadecimat for red
+
+// One byte per pixel formats (Bayer, YUV) are sent in byte pairs:
+// the lowest bit is 0 in the first and 1 in the second byte of a pair, so the host can find the pair alignment.
+const uint8_t PAIR_BYTE_MARKER = 0b00000001; // Lowest bit is sacrificed for the pair marker
+const uint8_t PAIR_BYTE_PREVENT_ZERO = 0b00000010; // A first byte of 0 is sent as 2 instead
+
+// Lookup tables from RGB565 bytes to RGB332. They are generated by the compiler and stay in flash.
+// H:RRRRRGGG -> RRRGGG00
+// L:GGGBBBBB -> 000000BB
+#define RGB332_FROM_H(h) ((uint8_t)(((h) & 0xE0) | (((h) & 0x07) << 2)))
+#define RGB332_FROM_L(l) ((uint8_t)(((l) >> 3) & 0x03))
+#define LUT_4(f, i) f(i), f((i) + 1), f((i) + 2), f((i) + 3)
+#define LUT_16(f, i) LUT_4(f, i), LUT_4(f, (i) + 4), LUT_4(f, (i) + 8), LUT_4(f, (i) + 12)
+#define LUT_64(f, i) LUT_16(f, i), LUT_16(f, (i) + 16), LUT_16(f, (i) + 32), LUT_16(f, (i) + 48)
+#define LUT_128(f, i) LUT_64(f, i), LUT_64(f, (i) + 64)
+#define LUT_256(f) LUT_128(f, 0), LUT_128(f, 128)
+const uint8_t rgb332FromH[256] PROGMEM = { LUT_256(RGB332_FROM_H) };
+const uint8_t rgb332FromL[256] PROGMEM = { LUT_256(RGB332_FROM_L) };
+const uint8_t RGB332_PREVENT_ZERO = 0x01; // Black is sent as the darkest blue
+
+// CRC-8 lookup table (polynomial 0x07, CRC-8/SMBUS) for UART_LINE_CRC.
+// One table read per sent byte is cheap enough for the send slots of the capture loop.
+constexpr uint8_t crc8Bits(uint8_t crc, uint8_t bits) {
+  return bits == 0 ? crc : crc8Bits((crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1), bits - 1);
+}
+#define CRC8_BYTE(i) crc8Bits((i), 8)
+const uint8_t crc8Table[256] PROGMEM = { LUT_256(CRC8_BYTE) };
+
+// RGB332 to palette index map, two indexes per byte. Until the host uploads its own map,
+// the top bit of red, green and blue select one of 8 colors (indexes 1 to 8).
+#define DEFAULT_PALETTE_INDEX(c) (1 + ((((c) >> 7) & 1) << 2) + ((((c) >> 4) & 1) << 1) + (((c) >> 1) & 1))
+#define DEFAULT_PALETTE_MAP_BYTE(k) ((uint8_t)((DEFAULT_PALETTE_INDEX((k) * 2) << 4) | DEFAULT_PALETTE_INDEX((k) * 2 + 1)))
+const uint8_t PALETTE_MAP_LENGTH = 128; // 256 colors, two per byte
+uint8_t paletteMap[PALETTE_MAP_LENGTH] = { LUT_128(DEFAULT_PALETTE_MAP_BYTE, 0) };
 
 //Calls the function for initzialization
 void processRgbFrameBuffered();
 void processRgbFrameDirect();
+void processBayerFrameBuffered();
+void processYuv420FrameBuffered();
+void processLumaFrameCoded();
+void processBtcFrame();
+void processEdgeFrame();
+void processDitherFrame();
+void processBlobFrame();
+void processProfileFrame();
 typedef void (*ProcessFrameData)(void) ;
 
 #if UART_MODE==1 // Serial and Camera Configuration #1
-const uint16_t lineLength = 320; //Resolution 320 pixels
-const uint16_t lineCount = 240; // Resolution 240 Pixels
+uint16_t lineLength = 320; //Resolution 320 pixels
+uint16_t lineCount = 240; // Resolution 240 Pixels
 // Both combined into 320 x 240 pixels
 const uint32_t baud  = 500000; // Baud rate is set to 500000/5kbps
 const ProcessFrameData processFrameData = processRgbFrameBuffered; //function pointer to process frame in RGB format
-const uint16_t lineBufferLength = lineLength * 2; // total length of line buffer
+const uint16_t lineBufferLength = 320 * 2; // total length of line buffer (fits the widest line)
 const bool isSendWhileBuffering = true; // Buffering flag
 const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_RGB565; // Pixel format fort UART Communication
+// Fastest clock for a narrow region of interest. The buffered RGB565 loop takes about 40 cycles
+// per byte, a QVGA byte comes every 4 * (pre-scaler + 1) cycles.
+const uint8_t minClockPreScaler = 12;
 CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_RGB565, 32); // Instance of CameraOV7670 with resolution and pixel format settings
 #endif
 
 #if UART_MODE==2 // Serial and Camera Configuration #2
-const uint16_t lineLength = 320;
-const uint16_t lineCount = 240;
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
 const uint32_t baud  = 1000000;
 const ProcessFrameData processFrameData = processRgbFrameBuffered;
-const uint16_t lineBufferLength = lineLength * 2;
+const uint16_t lineBufferLength = 320 * 2;
 const bool isSendWhileBuffering = true;
 const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_RGB565;
+const uint8_t minClockPreScaler = 12;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_RGB565, 16);
+#endif
+
+#if UART_MODE==3 // Raw Bayer VGA. One byte per pixel, the host does the demosaic.
+uint16_t lineLength = 640;
+uint16_t lineCount = 480;
+const uint32_t baud  = 2000000; // 2Mbaud is exact at 16MHz. A 640 byte line has to be sent before the next line ends.
+const ProcessFrameData processFrameData = processBayerFrameBuffered;
+const uint16_t lineBufferLength = 640;
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_BAYER8;
+// Fastest clock for a narrow region of interest. A VGA byte comes every 2 * (pre-scaler + 1) cycles.
+const uint8_t minClockPreScaler = 20;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_VGA_640x480, CameraOV7670::PIXEL_BAYERRGB, 40);
+#endif
+
+#if UART_MODE==4 // YUV 4:2:0. Full resolution luma, chroma on every other line.
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 1000000;
+const ProcessFrameData processFrameData = processYuv420FrameBuffered;
+const uint16_t lineBufferLength = 320 * 2;
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_YUV420;
+const uint8_t minClockPreScaler = 12;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_YUV422, 16);
+#endif
+
+#if UART_MODE==5 // RGB332 color preview. RGB565 from the camera is packed in the format slot.
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 1000000;
+const ProcessFrameData processFrameData = processRgbFrameBuffered;
+const uint16_t lineBufferLength = 320 * 2;
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_RGB332;
+// The packing needs the slower clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 16;
 CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_RGB565, 16);
 #endif
 
+#if UART_MODE==6 // 16 color palette preview, palette map from the host
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 1000000;
+const ProcessFrameData processFrameData = processRgbFrameBuffered;
+const uint16_t lineBufferLength = 320 * 2;
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_PALETTE4;
+// The palette lookup needs the slower clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 16;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_RGB565, 16);
+#endif
+
+#if UART_MODE==7 // Lossless coded grayscale. Each line is sent raw, run length coded or DPCM + Rice coded.
+uint16_t lineLength = 160;
+uint16_t lineCount = 120;
+const uint32_t baud  = 2000000; // A raw line and the coding have to fit between two QQVGA lines
+const ProcessFrameData processFrameData = processLumaFrameCoded;
+const uint16_t lineBufferLength = 160 * 2; // Current line and the line above it
+const bool isSendWhileBuffering = false;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_LUMA_CODED;
+// The line coding needs this clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 2;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QQVGA_160x120, CameraOV7670::PIXEL_YUV422, 2);
+#endif
+
+#if UART_MODE==8 // Block Truncation Coding. Lossy grayscale, 2 bits per pixel.
+uint16_t lineLength = 160;
+uint16_t lineCount = 120;
+const uint32_t baud  = 2000000;
+const ProcessFrameData processFrameData = processBtcFrame;
+const uint16_t lineBufferLength = 5 + 40 * 4 + 1; // One COMMAND_BTC_BLOCKS packet, one strip of 160 pixels
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_BTC;
+// The strip coding needs this clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 7;
+// 4 lines of 160 Y bytes. A QVGA strip (1280 bytes) and its packets would not fit into the 2KB SRAM.
+// Clock pre-scaler 7 leaves enough time after every 4th line to code the strip.
+StripBufferedCameraOV7670<160, 4> camera(CameraOV7670::RESOLUTION_QQVGA_160x120, CameraOV7670::PIXEL_YUV422, 7);
+#endif
+
+#if UART_MODE==9 // Sobel edge map, 1 bit per pixel
+uint16_t lineLength = 160;
+uint16_t lineCount = 120;
+const uint32_t baud  = 1000000;
+const ProcessFrameData processFrameData = processEdgeFrame;
+const uint16_t lineBufferLength = 160 * 3; // Rolling window of 3 luma lines
+const bool isSendWhileBuffering = false;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_EDGES;
+// The Sobel kernel needs this clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 3;
+// Clock pre-scaler 3 leaves about 40 cycles per pixel for the Sobel kernel
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QQVGA_160x120, CameraOV7670::PIXEL_YUV422, 3);
+#endif
+
+#if UART_MODE==10 // Ordered dither, 1 bit per pixel, for slow links
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 115200;
+const ProcessFrameData processFrameData = processDitherFrame;
+const uint16_t lineBufferLength = 4 + 320 / 8 + 1; // One COMMAND_PACKED_LINE packet
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_DITHER1;
+// Dither lines are short, the link is not the limit for narrow regions
+const uint8_t minClockPreScaler = 10;
+// A 45 byte line takes 3.9ms at 115200 baud, pre-scaler 10 makes the lines 4.3ms apart (about 0.9 fps)
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_YUV422, 10);
+#endif
+
+#if UART_MODE==11 // Ordered dither, 2 bits per pixel, for slow links
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 250000;
+const ProcessFrameData processFrameData = processDitherFrame;
+const uint16_t lineBufferLength = 4 + 320 / 4 + 1;
+const bool isSendWhileBuffering = true;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_DITHER2;
+// Dither lines are short, the link is not the limit for narrow regions
+const uint8_t minClockPreScaler = 9;
+// A 85 byte line takes 3.4ms at 250000 baud, pre-scaler 9 makes the lines 3.9ms apart (about 1 fps)
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_YUV422, 9);
+#endif
+
+#if UART_MODE==12 // Blob tracker. Sends bounding boxes instead of pixels.
+uint16_t lineLength = 160;
+uint16_t lineCount = 120;
+const uint32_t baud  = 2000000; // Fast enough for raw lines on request
+const ProcessFrameData processFrameData = processBlobFrame;
+const uint16_t lineBufferLength = 160; // One luma line
+const bool isSendWhileBuffering = false;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_BLOBS;
+// The blob search needs this clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 2;
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QQVGA_160x120, CameraOV7670::PIXEL_YUV422, 2);
+#endif
+
+#if UART_MODE==13 // Row and column projection profiles
+uint16_t lineLength = 320;
+uint16_t lineCount = 240;
+const uint32_t baud  = 1000000;
+const ProcessFrameData processFrameData = processProfileFrame;
+const uint16_t lineBufferLength = 320 * 2; // Column sums, 16-bit
+const bool isSendWhileBuffering = false;
+const uint8_t uartPixelFormat = UART_PIXEL_FORMAT_PROFILES;
+// The profile sums need this clock, narrow regions don't run faster
+const uint8_t minClockPreScaler = 5;
+// Two 16-bit adds per pixel fit into the byte slots at pre-scaler 5 (about 1.7 fps)
+CameraOV7670 camera(CameraOV7670::RESOLUTION_QVGA_320x240, CameraOV7670::PIXEL_YUV422, 5);
+#endif
+
+// RGB332 and palette modes pack the RGB565 pixels before sending
+const bool isPackedPixelFormat = uartPixelFormat == UART_PIXEL_FORMAT_RGB332 || uartPixelFormat == UART_PIXEL_FORMAT_PALETTE4;
+
+// Exposure control needs RGB statistics from the line buffer
+const bool isExposureControlEnabled = EXPOSURE_CONTROL && (
+    uartPixelFormat == UART_PIXEL_FORMAT_RGB565 || uartPixelFormat == UART_PIXEL_FORMAT_RGB332 || uartPixelFormat == UART_PIXEL_FORMAT_PALETTE4);
+const uint8_t EXPOSURE_SAMPLE_STEP = 8; // Every 8th pixel of every 8th line goes to the exposure statistics
+CameraOV7670ExposureControl exposureControl(camera);
+
 uint8_t lineBuffer [lineBufferLength]; // Array of bytes in which each pixel requires two bytes per pixel
 uint8_t * lineBufferSendByte; // Pointer to the current byte 
+uint8_t * lineBufferSendEnd; // Block Truncation Coding: end of the packets waiting in the line buffer
 bool isLineBufferSendHighByte; // Bool flag to indicate if the current byte being sent is high byte
 bool isLineBufferByteFormatted; // bool flage to indicate if the current byte being sent is low byte
-uint16_t frameCounter = 0; // Counter for tracking the numbers of frame being created
+uint8_t packedPixelByte; // Next byte to send in the RGB332 and palette modes
+uint8_t rgb332Pixel; // RGB332 value of the pixel that is being packed
+bool isPackedPixelLowNibble; // Palette mode: next index goes to the low nibble
+uint16_t frameCounter = 0; // Counter for tracking the numbers of frame being created, also the frame header sequence number
+uint32_t frameVsyncMicros; // micros() at the vsync of the frame that is sent
+
+// Counters are free running and wrap around, the host uses the difference between two records.
+// Gauges are the value of the last frame.
+struct Telemetry {
+  uint16_t framesCaptured; // Frames sent to the host
+  uint16_t framesSkipped; // Frames skipped while the servo moves or dwells
+  uint16_t servoSteps; // Scan steps started
+  uint16_t uartStalls; // Command payload bytes (sendNextCommandByte) that had to wait for the previous byte
+  uint16_t lineOverruns; // Lines that were not sent completely before the camera line ended, or coded lines that took longer than the line gap
+  uint16_t vsyncWaitMillis; // Gauge: wait for the vsync of the last frame
+  uint32_t sendSlotsMissed; // Gauge: pixel clocks of the last frame at which the UART was still busy
+  uint32_t drainBytes; // Gauge: bytes of the last frame that were sent after the camera line had ended
+  uint16_t longestDrainBytes; // Gauge: most bytes left over from one line of the last frame
+};
+Telemetry telemetry;
+const uint8_t TELEMETRY_FRAME_INTERVAL = 8; // Frames between COMMAND_TELEMETRY records
 uint16_t processedByteCountDuringCameraRead = 0; // tracks the number of bytes processed during camera read
+uint16_t lineSendSlotsMissed = 0; // Pixel clocks of the current line at which the UART was still busy
+uint8_t lineCrc; // UART_LINE_CRC: CRC-8 of the bytes of the current line that have been sent
+uint16_t frameCrc; // UART_LINE_CRC: CRC-16 (XMODEM) of the line CRCs of the current frame
+uint16_t frameCrcLines; // UART_LINE_CRC: number of COMMAND_LINE_CRC commands of the current frame
+bool isCameraOk = false; // Result of camera.init()
+uint16_t cameraReadyMillis = 0; // Milliseconds from power on until the camera delivered its first vsync
+bool isFirstFrameStarted = false; // Boot to first frame time is reported once
+
+uint16_t analysisThreshold = 160; // Set by the host with COMMAND_SET_THRESHOLD
+
+// Region of interest. Width or height 0 from the host selects the full frame again.
+uint16_t roiX = 0; // Left edge of the region of interest in pixels
+uint16_t roiY = 0; // Top edge of the region of interest in lines
+uint16_t roiWidth = lineLength; // Width of the region of interest in pixels
+uint16_t roiHeight = lineCount; // Height of the region of interest in lines
+uint8_t fullLineClockPreScaler; // Camera clock pre-scaler of the mode, set for full width lines
+
+// Host commands use the same framing as the commands sent to the host: 0x00, length, command bytes, checksum
+const uint8_t HOST_COMMAND_MAX_LENGTH = 34; // Longest host command that is accepted (palette map or 8 scan steps)
+enum HostCommandState {
+  HOST_COMMAND_WAIT_MARKER,
+  HOST_COMMAND_WAIT_LENGTH,
+  HOST_COMMAND_WAIT_DATA,
+  HOST_COMMAND_WAIT_CHECKSUM,
+  HOST_COMMAND_COMPLETE // Command in hostCommandBuffer waits for executeHostCommand
+};
+HostCommandState hostCommandState = HOST_COMMAND_WAIT_MARKER; // Parser state
+bool isHostCommandPollEnabled; // Capture takes host bytes straight from the UART
+uint8_t hostCommandBuffer [HOST_COMMAND_MAX_LENGTH]; // Command bytes received so far
+uint8_t hostCommandLength; // Expected number of command bytes
+uint8_t hostCommandIndex; // Number of command bytes received
+uint8_t hostCommandChecksum; // XOR of the received command bytes
 
 //Calls the function for initzialization
 void commandStartNewFrame(uint8_t pixelFormat); 
+void commandFrameHeader(uint8_t pixelFormat);
+void commandTelemetry();
+void countLineSend(uint16_t lineBytes);
+void commandLineCrc();
+void commandFrameEnd();
+#if PROBES_ENABLED
+void commandProbe(ProbeId probe);
+#endif
+uint8_t sendNextCommandWord(uint8_t checksum, uint16_t commandWord);
 void commandDebugPrint(const String debugText);
+template <typename... Arguments> void commandDebugLog(uint16_t id, Arguments... arguments);
+template <typename Argument, typename... Arguments> uint8_t sendDebugLogArguments(uint8_t checksum, Argument argument, Arguments... arguments);
+uint8_t sendDebugLogArguments(uint8_t checksum);
 uint8_t sendNextCommandByte(uint8_t checksum, uint8_t commandByte);
-void sendBlankFrame(uint16_t color);
+void commandStatus(bool isCameraOk, uint16_t cameraReadyMillis, uint16_t firstFrameMillis);
+void processHostCommands();
+void parseHostCommandByte(uint8_t receivedByte);
+void startHostCommandPolling();
+void pollHostCommandBytes();
+void executeHostCommand();
+void setRegionOfInterest(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+void setClockPreScalerForRegionOfInterest();
+void setCameraResolution(CameraOV7670::Resolution resolution);
+void setPaletteMap(uint8_t offset, const uint8_t * mapBytes, uint8_t length);
+void commandLumaLine(const uint8_t * line, const uint8_t * lineAbove, uint8_t length);
+void sendLumaLinePacket(uint8_t coding, const uint8_t * data, uint8_t length);
+void encodeBtcStrip(uint8_t stripIndex);
+void commandEdgeLine(uint8_t row);
+void resetBlobs();
+void processBlobLine(const uint8_t * line, uint8_t y);
+void commandBlobs();
+void commandProfile(uint8_t profile, const uint16_t * sums, uint16_t count);
+void commandServoMotion(uint8_t angle, uint8_t settleFrameCount);
+void captureFrame();
+bool runScanSchedule();
+void moveServo(uint8_t angle, uint8_t dwellFrames);
+bool waitForServo();
+void loadDefaultScanSchedule();
+void setScanSchedule(uint8_t offset, const uint8_t * stepBytes, uint8_t length);
+uint8_t getServoSettleFrameCount(uint8_t angleDelta);
+uint8_t selectLumaLineCoding(const uint8_t * line, const uint8_t * lineAbove, uint8_t length);
+bool encodeLumaLineRunLength(const uint8_t * line, uint8_t length);
+bool encodeLumaLineRice(const uint8_t * line, const uint8_t * lineAbove, uint8_t length, uint8_t k);
 
 /*
 The inline functions are initialized because they have a specific purpose in low-level programming
@@ -146,10 +524,16 @@ It overrides the compiler’s usual inlining decisions.
 inline void processNextRgbPixelByteInBuffer() __attribute__((always_inline));
 inline void tryToSendNextRgbPixelByteInBuffer() __attribute__((always_inline));
 inline void formatNextRgbPixelByteInBuffer() __attribute__((always_inline));
+inline void packNextRgbPixelByteInBuffer() __attribute__((always_inline));
+inline void tryToSendNextPacketByte() __attribute__((always_inline));
 inline uint8_t formatRgbPixelByteH(uint8_t byte) __attribute__((always_inline));
 inline uint8_t formatRgbPixelByteL(uint8_t byte) __attribute__((always_inline));
+inline void tryToSendNextPixelBytePairInBuffer() __attribute__((always_inline));
+inline uint8_t formatPixelBytePairFirst(uint8_t byte) __attribute__((always_inline));
+inline uint8_t formatPixelBytePairSecond(uint8_t byte) __attribute__((always_inline));
 inline void waitForPreviousUartByteToBeSent() __attribute__((always_inline));
 inline bool isUartReady() __attribute__((always_inline));
+inline void updateLineCrc(uint8_t byte) __attribute__((always_inline));
 
 
 // This part of code is the setup process
@@ -158,20 +542,23 @@ Setup Process:
 
 Servo Initialization:
 
-PWMServo myServo;: This line creates an instance of the PWMServo class to control a servo motor.
-Servo Positions:
-int servoPositions[] = {10, 35, 60, 85, 110, 135, 160, 175};: This array defines the sequence of positions (in degrees) that the servo will move through.
+The servo pulse is generated by Timer1Scheduler on pin D10 (OC1B).
+Scan Schedule:
+The servo positions are a list of scan steps (ScanStep): angle, dwell frames, frames to capture and pixel format.
+The default schedule is in flash (defaultScanSchedule) and goes back and forth over 10..175 degrees with one frame per angle.
+It is copied to RAM (scanSchedule) at startup and the host can replace it with COMMAND_SET_SCAN_SCHEDULE, so that more
+frames are spent on interesting angles and fewer on empty ones.
+A schedule longer than 8 steps is uploaded in order: each command starts at or before the end of the steps sent so far.
 
-Current Servo Position:
-int currentPositionIndex = 0;: This variable keeps track of the current position index within the servoPositions array.
-
-Timer Interrupt Service Routine (ISR):
-This function is triggered at regular intervals defined by the timer configuration.
-
-ISR(TIMER1_COMPA_vect): This line declares the function as an Interrupt Service Routine (ISR) for the Timer/Counter1 Compare Match A interrupt vector.
+Frame Capture (captureFrame):
+This function is called from loop() for every frame, so the frames are captured back to back as fast as the camera and
+the link allow. Host commands are read between two frames.
+Interrupts are disabled while it runs, because the pixel bytes are read by polling the pixel clock
+and an interrupt in the middle of a line would shift the bytes. The servo pulse keeps running in hardware.
 
 Update Servo Position:
-The code increments or decrements the currentPositionIndex to move through the servoPositions array in a loop.
+runScanSchedule() is called before every frame. When the current step has captured all its frames it moves the servo
+to the angle of the next step and the step's frames are captured next.
 
 Start New Frame:
 commandStartNewFrame(uartPixelFormat);: This sends a "new frame" command over UART to indicate the beginning of a new image frame.
@@ -182,11 +569,17 @@ processFrameData();: This function call executes either processRgbFrameBuffered
 Frame Counter:
 frameCounter++;: This variable keeps track of the total number of frames processed.
 
-Debug Message:
-commandDebugPrint("Frame " + String(frameCounter));: This sends a debug message over UART indicating the current frame number.
+Telemetry:
+commandTelemetry();: Every TELEMETRY_FRAME_INTERVAL frames the telemetry counters are sent as one binary COMMAND_TELEMETRY record.
+It replaces the "Frame N" and "Vsync" debug messages that built Strings on the heap and took dozens of UART bytes per frame.
 
 Move Servo:
-myServo.write(servoPositions[currentPositionIndex]);: This line instructs the servo motor to move to the position specified by the current index in the servoPositions array.
+moveServo(angle, dwellFrames);: This function instructs the servo motor to move to the angle of the scan step.
+The write is done right after vsync, so the move starts in vertical blanking. The frames that are predicted to be captured
+while the servo is still moving (getServoSettleFrameCount) or during the dwell time of the step are not read.
+A short COMMAND_SERVO_MOTION packet is sent for each of them instead.
+waitForServo() does this one vsync at a time from loop() with interrupts enabled. A dwell of many frames does not block
+the host commands (a new schedule can be uploaded during it), millis() or the telemetry.
 
 Arduino setup() function:
 This function runs only once at the beginning of the program.
@@ -196,156 +589,240 @@ Serial.begin(baud);: This initializes the serial communication (UART) with the s
 
 Camera Initialization:
 It checks if the camera initialization using camera.init() is successful.
-Based on the result, it sends either a green or red blank frame using sendBlankFrame (presumably for visual indication).
+camera.init() does not use fixed delays. It polls the camera product ID until the camera answers and returns after
+the first vsync, so the camera is known to be running.
+After a successful init the camera register setters are switched to deferred writes, so they can be called at any time
+without disturbing the capture timing. captureFrame writes the queued registers right after vsync, with interrupts enabled
+since Wire needs them.
+The result and the time it took are sent to the host with a short COMMAND_STATUS instead of a full blank frame.
+When the first frame starts, COMMAND_STATUS is sent again with the boot to first frame time.
 
 Timer1 Configuration:
 
-It disables global interrupts (cli()), sets Timer1 registers (TCCR1A and TCCR1B) to zero, and configures the timer for:
-A desired timer count (OCR1A) for a 1-second interval (considering clock speed and prescaler).
-CTC (Clear Timer on Compare Match) mode.
-A 256 prescaler (CS12).
-Enabling the Timer Compare Match A interrupt (OCIE1A).
-Finally, it re-enables global interrupts (sei()).
-
-Servo Attachment:
-myServo.attach(10);: This attaches the servo motor to the digital pin D10 for controlling its movement.
+Timer1Scheduler::begin() is the only place where Timer1 is configured. Earlier the frame timer (CTC mode, 256 prescaler)
+and PWMServo both used Timer1 and fought over it. Now Timer1 runs in fast PWM mode with a 20ms period:
+OC1B generates the servo pulse on D10 and the compare match A interrupt counts software ticks.
+Timer0 is left for millis().
+The frames are not paced by a tick. The capture runs with interrupts disabled, so a tick would only
+count between frames and add its period as idle time to every frame.
 
 Arduino loop() function:
-This function repeatedly executes the main program logic.
+This function captures the next frame. Host commands are read between frames.
+*/
 
-Frame Switching Time:
-unsigned long lastFrameTime = millis();: This variable stores the time of the last frame processing for timing calculations.
+// One step of the servo scan. Also the format of the steps in COMMAND_SET_SCAN_SCHEDULE.
+struct ScanStep {
+  uint8_t angle; // Servo angle in degrees
+  uint8_t dwellFrames; // Frames to skip at the angle before capturing, the predicted settle time is skipped anyway
+  uint8_t captureFrames; // Frames to capture at the angle
+  uint8_t pixelFormat; // 0 or uartPixelFormat. Steps for other formats only move and dwell.
+};
+
+const uint8_t SCAN_SCHEDULE_MAX_STEPS = 16; // Length of the RAM copy
+const ScanStep defaultScanSchedule[] PROGMEM = { // Back and forth with one frame per angle
+  {10, 0, 1, 0}, {35, 0, 1, 0}, {60, 0, 1, 0}, {85, 0, 1, 0}, {110, 0, 1, 0}, {135, 0, 1, 0}, {160, 0, 1, 0},
+  {175, 0, 1, 0}, {160, 0, 1, 0}, {135, 0, 1, 0}, {110, 0, 1, 0}, {85, 0, 1, 0}, {60, 0, 1, 0}, {35, 0, 1, 0}
+};
+ScanStep scanSchedule[SCAN_SCHEDULE_MAX_STEPS]; // Schedule that is executed
+uint8_t scanScheduleLength; // Number of steps in scanSchedule
+uint8_t scanStepIndex; // Next step to start
+uint8_t scanStepFramesLeft; // Frames still to capture in the current step
+uint8_t servoAngle = 90; // Current servo angle in degrees, Timer1Scheduler starts in the middle
+uint8_t servoVsyncsLeft; // Vsyncs before the next capture: the one that starts the move and one per skipped frame
+bool isServoMoveStarted; // The angle of the move has been written to Timer1Scheduler
+bool wasVsyncHigh; // Vsync level at the previous waitForServo call
+const uint8_t SERVO_SETTLE_MILLIS = 60; // SG90 ringing after the move has ended
+const uint8_t SERVO_MILLIS_PER_DEGREE = 2; // SG90 slew rate, about 0.1s per 60 degrees
+
+
+// Captures one frame. Called with interrupts disabled.
+// Host commands are not read here, a resolution change writes camera registers over Wire.
+void captureFrame() {
+  // Report the boot to first frame time once
+  if (!isFirstFrameStarted) {
+    isFirstFrameStarted = true;
+    commandStatus(isCameraOk, cameraReadyMillis, millis());
+  }
 
-Motion Time:
-unsigned long lastMotionTime = 0;: This variable keeps track of the time when motion was last detected (presumably for image processing control).
+  // Vertical blanking. Interrupts are enabled for micros() and for the register writes over Wire.
+  // The frame functions wait for vsync again, which returns at once while vsync is still high.
+  interrupts();
+  uint32_t vsyncWaitStartMicros = micros();
+  PROBE_START(PROBE_VSYNC_WAIT);
+  camera.waitForVsync();
+  PROBE_STOP(PROBE_VSYNC_WAIT);
+  frameVsyncMicros = micros();
+  telemetry.vsyncWaitMillis = (frameVsyncMicros - vsyncWaitStartMicros) / 1000;
+  // New exposure and white balance from the statistics of the previous frame
+  PROBE_START(PROBE_BLANKING_UPDATE);
+  if (isExposureControlEnabled) {
+    exposureControl.update();
+  }
+  // Apply queued camera register changes while the camera is in vertical blanking
+  camera.writeQueuedRegisters();
+  PROBE_STOP(PROBE_BLANKING_UPDATE);
+  noInterrupts();
 
-Processed Byte Count:
-processedByteCountDuringCameraRead = 0;: This variable is initialized to zero to track the number of bytes processed during camera reading within the frame processing function.
+  // Host bytes of the frame are taken from the UART in the line gaps
+  startHostCommandPolling();
 
-Start New Frame:
-Similar to the timer interrupt routine, it sends a "new frame" command using commandStartNewFrame.
+  // Gauges of this frame
+  telemetry.sendSlotsMissed = 0;
+  telemetry.drainBytes = 0;
+  telemetry.longestDrainBytes = 0;
+  frameCrc = 0;
+  frameCrcLines = 0;
 
-Enable Timer Interrupt:
-TIMSK1 |= (1 << OCIE1A);: This enables the Timer Compare Match A interrupt for the servo movement logic.
+  // Start a new frame with the specified pixel format
+  PROBE_START(PROBE_COMMAND_SEND);
+  commandStartNewFrame(uartPixelFormat);
+  PROBE_STOP(PROBE_COMMAND_SEND);
 
-Frame Counter:
-Same as the timer interrupt routine, it increments the frameCounter.
+  // Process the frame data
+  processFrameData();
 
-Debug Message:
-Similar to the timer interrupt routine, it sends a debug message
-*/
+  // Checksum of the whole frame, sent before frameCounter moves on to the next sequence number
+  if (UART_LINE_CRC) {
+    commandFrameEnd();
+  }
 
-PWMServo myServo; // Initialize instance of PWMServo
-volatile bool updateServo = false; // Set the initial state to false
-int servoPositions[] = {10, 35, 60, 85, 110, 135, 160, 175}; //Array holding the degrees of the servo to be traversed
-int currentPositionIndex; // Set the current position to index 0
-bool servoDirection; // Set initial direction to forward (optional)
-bool firstLoop = true;
-
-
-// Timer interrupt service routine
-ISR(TIMER1_COMPA_vect) {
-  // Increment or decrement the position index (wrap around if needed)
-// Check current position and direction
-  if (currentPositionIndex == sizeof(servoPositions) / sizeof(servoPositions[0]) - 1 && servoDirection) {
-    // Reached the end (175 degrees), reverse direction
-    currentPositionIndex--;
-    servoDirection = false;
-  } else if (currentPositionIndex == 0 && !servoDirection) {
-    // Reached the beginning (10 degrees), reverse direction
-    currentPositionIndex++;
-    servoDirection = true;
-  } else {
-    // Move in the current direction
-    if (servoDirection) {
-      currentPositionIndex++;
-    } else {
-      currentPositionIndex--;
+  // Increment the frame counter
+  frameCounter++;
+
+  telemetry.framesCaptured++;
+
+  // Counters instead of a debug message per frame
+  if (frameCounter % TELEMETRY_FRAME_INTERVAL == 0) {
+    commandTelemetry();
+#if PROBES_ENABLED
+    // Statistics of the frames since the previous record
+    for (uint8_t probe = 0; probe < PROBE_COUNT; probe++) {
+      commandProbe((ProbeId)probe);
     }
+    probeReset();
+#endif
   }
+}
 
-  // Move the servo based on the updated index
-  myServo.write(servoPositions[currentPositionIndex]);
 
-  // Start a new frame with the specified pixel format
-  commandStartNewFrame(uartPixelFormat);
+// Scan schedule interpreter, called from loop() once the servo has settled.
+// Returns true if the next frame is captured. A new step only starts the
+// servo move, its frames are captured after waitForServo.
+bool runScanSchedule() {
+  if (scanStepFramesLeft == 0) {
+    ScanStep step = scanSchedule[scanStepIndex];
+    scanStepIndex = scanStepIndex + 1 < scanScheduleLength ? scanStepIndex + 1 : 0;
 
-  // Process the frame data
-  processFrameData();
+    moveServo(step.angle, step.dwellFrames);
 
-  // Increment the frame counter
-  frameCounter++;
+    // The pixel format is fixed by UART_MODE. A step may also only move and dwell.
+    bool isStepPixelFormat = step.pixelFormat == 0 || step.pixelFormat == uartPixelFormat;
+    scanStepFramesLeft = isStepPixelFormat ? step.captureFrames : 0;
+    return false;
+  }
+  scanStepFramesLeft--;
+  return true;
+}
 
-  // Send a debug message indicating the frame number
-  commandDebugPrint("Frame " + String(frameCounter));
 
-  //currentPositionIndex = 0;
+// Starts a servo move at the next vsync, so the move starts in vertical blanking.
+// The frames captured while the servo is predicted to be moving and the dwell
+// frames are skipped. Nothing waits here, waitForServo counts the vsyncs.
+void moveServo(uint8_t angle, uint8_t dwellFrames) {
+  uint8_t skipFrameCount = getServoSettleFrameCount(abs(angle - servoAngle));
+  if (dwellFrames > skipFrameCount) {
+    skipFrameCount = dwellFrames;
+  }
+  servoAngle = angle;
+  telemetry.servoSteps++;
+  telemetry.framesSkipped += skipFrameCount;
+
+  servoVsyncsLeft = skipFrameCount + 1;
+  isServoMoveStarted = false;
+  // Vsync that is already high starts the move, like waitForVsync
+  wasVsyncHigh = false;
 }
 
 
-// Arduino setup()
-void initializeScreenAndCamera() {
-  Serial.begin(baud);
-  if (camera.init()) {
-    sendBlankFrame(COLOR_GREEN);
-    delay(1000);
-  } else {
-    sendBlankFrame(COLOR_RED);
-    delay(3000);
+// Called from loop() with interrupts enabled. Takes one step of the servo move
+// at each vsync and returns at once otherwise, so host commands, millis() and
+// the telemetry keep going during long dwells.
+// Returns true while the next capture has to wait.
+bool waitForServo() {
+  if (servoVsyncsLeft == 0) {
+    return false;
   }
+  bool isVsyncHigh = camera.isVsyncHigh();
+  bool isVsyncStart = isVsyncHigh && !wasVsyncHigh;
+  wasVsyncHigh = isVsyncHigh;
+  if (!isVsyncStart) {
+    return true;
+  }
+
+  if (!isServoMoveStarted) {
+    isServoMoveStarted = true;
+    Timer1Scheduler::setServoAngle(servoAngle);
+  }
+  servoVsyncsLeft--;
+  if (servoVsyncsLeft == 0) {
+    // The capture starts in this vertical blanking
+    return false;
+  }
+  // Let the host know that a frame is skipped and how many are still to come
+  commandServoMotion(servoAngle, servoVsyncsLeft);
+  return true;
+}
 
-  // Set up Timer1
-  cli(); // Disable global interrupts
-  TCCR1A = 0; // Set entire TCCR1A register to 0
-  TCCR1B = 0; // Same for TCCR1B
 
-  // Set compare match register to desired timer count:
-  OCR1A = 15624; // 1 second at 16MHz with prescaler of 256
-  //15624
-  // Turn on CTC mode:
-  TCCR1B |= (1 << WGM12);
+void loadDefaultScanSchedule() {
+  memcpy_P(scanSchedule, defaultScanSchedule, sizeof(defaultScanSchedule));
+  scanScheduleLength = sizeof(defaultScanSchedule) / sizeof(ScanStep);
+  scanStepIndex = 0;
+  scanStepFramesLeft = 0;
+}
 
-  // Set CS12 bit for 256 prescaler:
-  TCCR1B |= (1 << CS12);
 
-  // Enable timer compare interrupt:
-  TIMSK1 |= (1 << OCIE1A);
+// Arduino setup()
+void initializeScreenAndCamera() {
+  Serial.begin(baud);
+  fullLineClockPreScaler = camera.getInternalClockPreScaler();
+  isCameraOk = camera.init();
+  cameraReadyMillis = millis();
+  if (isCameraOk) {
+    // From now on camera setters only queue the register writes.
+    // captureFrame writes them out right after vsync.
+    if (isExposureControlEnabled) {
+      // Registers are read back from the camera, so this has to be done before deferring the writes
+      exposureControl.begin();
+    }
+    camera.setDeferRegisterWrites(true);
+  }
+  // Let the host know if the camera is working
+  commandStatus(isCameraOk, cameraReadyMillis, 0);
 
-  sei(); // Enable global interrupts
-  
-  myServo.attach(10); //Set the servo to read from the D10 pin
+  // Scan schedule from flash until the host uploads one
+  loadDefaultScanSchedule();
 
-  servoDirection = true; // Set initial direction to forward (optional)
-  
-  currentPositionIndex = 0;
+  // Servo pulse on D10 from Timer1
+  Timer1Scheduler::begin();
+  Timer1Scheduler::setServoAngle(servoAngle);
 }
 
 
 // Arduino loop()
 void processFrame() {
-  // Initialize time for frame switching
-  unsigned long lastFrameTime = millis();
-  unsigned long lastMotionTime = 0;
+  // Read host commands between two frames
+  processHostCommands();
 
-  if (firstLoop) {
-    currentPositionIndex = 0;
-    firstLoop = false; // Reset flag after first loop
+  // Servo moves and dwell frames take one pass of loop() per vsync
+  if (waitForServo() || !runScanSchedule()) {
+    return;
   }
-  
-  // Initialize processed byte count during camera read
-  processedByteCountDuringCameraRead = 0;
-
-  // Start a new frame with the specified pixel format
-  commandStartNewFrame(uartPixelFormat);
-
-  // Enable timer interrupt for servo movement
-  TIMSK1 |= (1 << OCIE1A);
-
-  // Increment the frame counter
-  frameCounter++;
 
-  // Send a debug message indicating the frame number
-  commandDebugPrint("Frame " + String(frameCounter));
+  // Pixel reads are timed by polling. No interrupts until the frame is done.
+  noInterrupts();
+  captureFrame();
+  interrupts();
 }
 
 
@@ -370,63 +847,111 @@ No line buffer: It doesn't use a line buffer. Instead, it processes each pixel b
 Formatting and sending: For each pixel, it reads the byte from the camera, formats it (high or low byte), waits for UART to be ready, and then transmits the formatted byte.
 
 
-Buffered processing is generally more efficient for high baud rates (faster UART communication) as it avoids waiting for individual bytes to be sent before processing the next pixel.
-Direct processing might be simpler to understand but could be less efficient at higher baud rates due to the wait times involved for UART transmission.
-Both functions assume helper functions for formatting the individual pixel bytes (high and low) according to the chosen UART pixel format (e.g., RGB565) and handling UART communication details like waiting for transmission to complete.
-*/
+3. processBayerFrameBuffered (Raw Bayer)
 
+Same line buffer approach as processRgbFrameBuffered, but with one byte per pixel.
+Formatting a Bayer byte is a single bit operation, so it is done in the same cycle as sending it.
+This way the UART can send one byte for every byte read from the camera, which is needed to keep up with VGA lines.
 
-// For initialization of the first frame to ensure the camera is working properly
-void sendBlankFrame(uint16_t color) {
-  // Extract the high and low bytes of the specified color
-  uint8_t colorH = (color >> 8) & 0xFF;
-  uint8_t colorL = color & 0xFF;
+In the RGB332 and palette modes processRgbFrameBuffered is used as it is. The format slot packs the pixel instead:
+the high byte and the low byte each give part of the RGB332 value through a lookup table in flash,
+and in the palette mode the RGB332 value is mapped to a palette index. The send slot sends the packed byte once it is complete.
 
-  // Start a new frame with the specified pixel format (RGB565)
-  commandStartNewFrame(UART_PIXEL_FORMAT_RGB565);
+5. processLumaFrameCoded (lossless coded grayscale)
 
-  // Iterate through each line (height) of the frame
-  for (uint16_t j = 0; j < lineCount; j++) {
-    // Iterate through each pixel in the line (width)
-    for (uint16_t i = 0; i < lineLength; i++) {
-      // Wait for the previous UART byte to be sent
-      waitForPreviousUartByteToBeSent();
+Only the Y bytes of a QQVGA YUV422 line are stored. The line above stays in the other half of the line buffer.
+After the line has been read (QQVGA lines are 4 camera lines apart, so there is time until the next one) the line is coded
+with commandLumaLine and sent as one packet.
 
-      // Send the high byte of the color
-      UDR0 = formatRgbPixelByteH(colorH);
+6. processBtcFrame (Block Truncation Coding)
 
-      // Wait for the previous UART byte to be sent
-      waitForPreviousUartByteToBeSent();
+The Y bytes of 4 lines are kept in the strip buffer of StripBufferedCameraOV7670.
+After every 4th line the strip is coded into COMMAND_BTC_BLOCKS packets in the line buffer (encodeBtcStrip).
+The packets are sent while the next 4 lines are read, one byte in the time of each dropped chroma byte.
+
+7. processEdgeFrame (Sobel edge map)
+
+The Y bytes of the last 3 lines are kept in the line buffer. While a line is read, the edge of the pixel in the middle line
+is computed in the time of the dropped chroma byte, one pixel behind the camera.
+The Sobel kernel is split into per column parts that are computed once and shifted along:
+  column sum s = top + 2 * middle + bottom and column difference d = bottom - top
+  Gx = s(x + 1) - s(x - 1), Gy = d(x - 1) + 2 * d(x) + d(x + 1)
+A pixel is an edge if |Gx| + |Gy| is above analysisThreshold. The bits of the middle line are sent after the line has been read.
+
+8. processDitherFrame (ordered dither)
+
+Every Y byte is compared against the 4x4 Bayer matrix entry for (x & 3, y & 3) as it arrives, no lines are buffered.
+The bits go straight into a COMMAND_PACKED_LINE packet in the line buffer that is sent while the line is read
+and finished between lines. 1 bit per pixel is 40 bytes for a 320 pixel line, 2 bits per pixel 80 bytes.
+
+9. processBlobFrame (blob tracker)
+
+Like processLumaFrameCoded the Y bytes of a QQVGA line are stored. Between lines processBlobLine finds the runs of pixels
+above analysisThreshold and joins them with the runs of the line above into blobs.
+At the end of the frame only the blobs are sent, a few dozen bytes instead of a frame.
+
+10. processProfileFrame (projection profiles)
+
+Every Y byte (halved, so the sums fit into 16 bits) is added to the sum of its line and to the sum of its column
+in the two byte slots of the pixel. Column sums are kept in the line buffer, line sums in rowProfile.
+After the frame both profiles are sent, 2 * (240 + 320) bytes plus the packet headers for a QVGA frame.
+The host finds motion by comparing the profiles of consecutive frames.
+
+4. processYuv420FrameBuffered (YUV 4:2:0)
+
+The camera sends Y U Y V. Even lines are buffered and sent as they are.
+On odd lines only the Y bytes are stored, the chroma bytes are just clocked by. Every two lines take 3 bytes per pixel instead of 4.
+
+Buffered processing is generally more efficient for high baud rates (faster UART communication) as it avoids waiting for individual bytes to be sent before processing the next pixel.
+Direct processing might be simpler to understand but could be less efficient at higher baud rates due to the wait times involved for UART transmission.
+Both functions assume helper functions for formatting the individual pixel bytes (high and low) according to the chosen UART pixel format (e.g., RGB565) and handling UART communication details like waiting for transmission to complete.
+*/
 
-      // Send the low byte of the color
-      UDR0 = formatRgbPixelByteL(colorL);
-    }
-  }
-}
 
 // This is for the buffered image processing
 void processRgbFrameBuffered() {
   // Wait for the vertical sync signal (Vsync)
   camera.waitForVsync();
-  commandDebugPrint("Vsync");
 
   // Ignore any vertical padding (if present)
   camera.ignoreVerticalPadding();
 
-  // Iterate through each line (height) of the frame
-  for (uint16_t y = 0; y < lineCount; y++) {
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // Byte range of the region of interest inside a camera line (two bytes per pixel)
+  const uint16_t roiLineStart = roiX * 2;
+  const uint16_t roiLineBytes = roiWidth * 2;
+  const uint16_t roiLineEnd = roiLineStart + roiLineBytes;
+  const uint16_t cameraLineBytes = lineLength * 2;
+
+  // Iterate through each line (height) of the region of interest.
+  // Lines below it are not read at all.
+  for (uint16_t y = 0; y < roiHeight; y++) {
     // Initialize the line buffer send pointer
     lineBufferSendByte = &lineBuffer[0];
+    lineSendSlotsMissed = 0;
+    lineCrc = 0;
     // Line starts with the high byte
     isLineBufferSendHighByte = true;
     // Flag indicating whether the byte in the line buffer has been formatted
     isLineBufferByteFormatted = false;
+    // Palette mode starts every line with the high nibble
+    isPackedPixelLowNibble = false;
+
+    // Started in the horizontal blanking, there is no time for it once the line has started
+    PROBE_START(PROBE_LINE_CAPTURE);
 
     // Ignore any left horizontal padding
     camera.ignoreHorizontalPaddingLeft();
 
-    // Iterate through each pixel in the line (width)
-    for (uint16_t x = 0; x < lineBufferLength; x++) {
+    // Skip the pixels left of the region of interest
+    for (uint16_t x = 0; x < roiLineStart; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Iterate through each pixel in the region of interest (width)
+    for (uint16_t x = 0; x < roiLineBytes; x++) {
       // Wait for the rising edge of the pixel clock
       camera.waitForPixelClockRisingEdge();
       // Read the pixel byte from the camera
@@ -437,17 +962,61 @@ void processRgbFrameBuffered() {
       }
     }
 
+    // Keep sending while the pixels right of the region of interest go by
+    for (uint16_t x = roiLineEnd; x < cameraLineBytes; x++) {
+      camera.waitForPixelClockRisingEdge();
+      if (lineBufferSendByte < &lineBuffer[roiLineBytes] || isLineBufferByteFormatted) {
+        processNextRgbPixelByteInBuffer();
+      }
+    }
+
     // Ignore any right horizontal padding
     camera.ignoreHorizontalPaddingRight();
+    PROBE_STOP(PROBE_LINE_CAPTURE);
 
-    // Debug info: Calculate the number of processed bytes during line read
-    processedByteCountDuringCameraRead = lineBufferSendByte - (&lineBuffer[0]);
+    // Debug info: Count what is left for the drain below
+    countLineSend(roiLineBytes);
 
-    // Send the remaining part of the line
-    while (lineBufferSendByte < &lineBuffer[lineLength * 2]) {
+    // Send the remaining part of the line.
+    // In the packed modes the last byte is still waiting when the whole buffer has been read.
+    PROBE_START(PROBE_LINE_DRAIN);
+    while (lineBufferSendByte < &lineBuffer[roiLineBytes] || isLineBufferByteFormatted) {
       processNextRgbPixelByteInBuffer();
     }
+    PROBE_STOP(PROBE_LINE_DRAIN);
+
+    if (UART_LINE_CRC) {
+      commandLineCrc();
+    }
+
+    // Sample the line for the exposure statistics.
+    // The lowest bits may have been changed by the formatting, which doesn't matter for the averages.
+    if (isExposureControlEnabled && (y % EXPOSURE_SAMPLE_STEP) == 0) {
+      for (uint16_t x = 0; x < roiLineBytes; x += EXPOSURE_SAMPLE_STEP * 2) {
+        exposureControl.addRgb565Sample(lineBuffer[x], lineBuffer[x + 1]);
+      }
+    }
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+
+
+// Called after the camera line has ended and before the rest of the line is sent.
+// Adds the line to the send gauges of the frame.
+void countLineSend(uint16_t lineBytes) {
+  processedByteCountDuringCameraRead = lineBufferSendByte - (&lineBuffer[0]);
+  if (processedByteCountDuringCameraRead < lineBytes) {
+    uint16_t drainBytes = lineBytes - processedByteCountDuringCameraRead;
+    telemetry.lineOverruns++;
+    telemetry.drainBytes += drainBytes;
+    if (drainBytes > telemetry.longestDrainBytes) {
+      telemetry.longestDrainBytes = drainBytes;
+    }
   }
+  // Misses during the drain are not counted, the drain only waits for the UART
+  telemetry.sendSlotsMissed += lineSendSlotsMissed;
 }
 
 
@@ -468,17 +1037,33 @@ void processNextRgbPixelByteInBuffer() {
 void tryToSendNextRgbPixelByteInBuffer() {
   // Check if the UART is ready for transmission
   if (isUartReady()) {
-    // Send the byte pointed to by lineBufferSendByte
-    UDR0 = *lineBufferSendByte;
-    // Move the pointer to the next byte in the buffer
-    lineBufferSendByte++;
+    if (isPackedPixelFormat) {
+      // The packed byte was already taken from the buffer
+      UDR0 = packedPixelByte;
+      updateLineCrc(packedPixelByte);
+    } else {
+      // Send the byte pointed to by lineBufferSendByte
+      UDR0 = *lineBufferSendByte;
+      updateLineCrc(*lineBufferSendByte);
+      // Move the pointer to the next byte in the buffer
+      lineBufferSendByte++;
+    }
     // Mark the byte as unformatted (to be formatted next time)
     isLineBufferByteFormatted = false;
+  } else {
+    // Only 16-bit per line, there is no time for more between two pixel clocks
+    lineSendSlotsMissed++;
   }
 }
 
 // 3rd function for buffered processing
 void formatNextRgbPixelByteInBuffer() {
+  // RGB332 and palette modes replace the formatting with packing
+  if (isPackedPixelFormat) {
+    packNextRgbPixelByteInBuffer();
+    return;
+  }
+
   // Determine whether the current byte is the high or low byte
   if (isLineBufferSendHighByte) {
     // Format the high byte of the RGB pixel
@@ -496,118 +1081,1363 @@ void formatNextRgbPixelByteInBuffer() {
 }
 
 
-/// This is for the direct image processing
-void processRgbFrameDirect() {
+// This is for the raw Bayer image processing
+void processBayerFrameBuffered() {
   // Wait for the vertical sync signal (Vsync)
   camera.waitForVsync();
-  commandDebugPrint("Vsync");
 
   // Ignore any vertical padding (if present)
   camera.ignoreVerticalPadding();
 
-  // Iterate through each line (height) of the frame
-  for (uint16_t y = 0; y < lineCount; y++) {
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // One byte per pixel
+  const uint16_t roiLineEnd = roiX + roiWidth;
+
+  // Iterate through each line (height) of the region of interest.
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Initialize the line buffer send pointer
+    lineBufferSendByte = &lineBuffer[0];
+    lineSendSlotsMissed = 0;
+    lineCrc = 0;
+    // Line starts with the first byte of a pair
+    isLineBufferSendHighByte = true;
+
     // Ignore any left horizontal padding
     camera.ignoreHorizontalPaddingLeft();
 
-    // Iterate through each pixel in the line (width)
-    for (uint16_t x = 0; x < lineLength; x++) {
-      // Wait for the rising edge of the pixel clock
+    // Skip the pixels left of the region of interest
+    for (uint16_t x = 0; x < roiX; x++) {
       camera.waitForPixelClockRisingEdge();
-      // Read the pixel byte from the camera
-      camera.readPixelByte(lineBuffer[0]);
-      // Format the high byte of the RGB pixel
-      lineBuffer[0] = formatRgbPixelByteH(lineBuffer[0]);
-      // Wait for the previous UART byte to be sent
-      waitForPreviousUartByteToBeSent();
-      // Send the formatted high byte over UART
-      UDR0 = lineBuffer[0];
+    }
 
+    // Iterate through each pixel in the region of interest (width)
+    for (uint16_t x = 0; x < roiWidth; x++) {
       // Wait for the rising edge of the pixel clock
       camera.waitForPixelClockRisingEdge();
       // Read the pixel byte from the camera
-      camera.readPixelByte(lineBuffer[0]);
-      // Format the low byte of the RGB pixel
-      lineBuffer[0] = formatRgbPixelByteL(lineBuffer[0]);
-      // Wait for the previous UART byte to be sent
-      waitForPreviousUartByteToBeSent();
-      // Send the formatted low byte over UART
-      UDR0 = lineBuffer[0];
+      camera.readPixelByte(lineBuffer[x]);
+      // Send the oldest byte that has not been sent yet
+      if (isSendWhileBuffering) {
+        tryToSendNextPixelBytePairInBuffer();
+      }
+    }
+
+    // Keep sending while the pixels right of the region of interest go by
+    for (uint16_t x = roiLineEnd; x < lineLength; x++) {
+      camera.waitForPixelClockRisingEdge();
+      if (lineBufferSendByte < &lineBuffer[roiWidth]) {
+        tryToSendNextPixelBytePairInBuffer();
+      }
     }
 
     // Ignore any right horizontal padding
     camera.ignoreHorizontalPaddingRight();
-  }
-}
 
+    // Debug info: Count what is left for the drain below
+    countLineSend(roiWidth);
 
-// This part of code is for pixel formatting
-/*
-formatRgbPixelByteH(uint8_t pixelByteH):
-
-This function formats the high byte of an RGB pixel for transmission over UART.
-It ensures two things:
-Non-zero color value: It guarantees the pixel value is always slightly above zero by using the L_BYTE_PREVENT_ZERO constant. This is because zero is often used as an end-of-line marker in UART communication.
-Odd parity: It verifies if an odd number of bits are set in the high byte using the H_BYTE_PARITY_CHECK constant. It then adjusts the parity bit (H_BYTE_PARITY_INVERT) to maintain an odd number of set bits for error detection during transmission.
+    // Send the remaining part of the line
+    while (lineBufferSendByte < &lineBuffer[roiWidth]) {
+      tryToSendNextPixelBytePairInBuffer();
+    }
 
-formatRgbPixelByteL(uint8_t pixelByteL):
-This function formats the low byte of an RGB pixel for UART transmission.
-Similar to the high byte function, it ensures:
-Non-zero color value: The pixel value is kept slightly above zero using L_BYTE_PREVENT_ZERO.
-Even parity: It checks if an even number of bits are set in the low byte using L_BYTE_PARITY_CHECK and adjusts the parity bit (L_BYTE_PARITY_INVERT) to achieve even parity.
-*/
+    if (UART_LINE_CRC) {
+      commandLineCrc();
+    }
 
-// Format the high byte of an RGB pixel
-// Ensures that:
-// A: The pixel color is always slightly above 0 (since zero is an end-of-line marker)
-// B: An odd number of bits are set for the H byte under H_BYTE_PARITY_CHECK and H_BYTE_PARITY_INVERT
-uint8_t formatRgbPixelByteH(uint8_t pixelByteH) {
-  // Check if the parity check bit is set
-  if (pixelByteH & H_BYTE_PARITY_CHECK) {
-    // Clear the parity inversion bit to maintain an odd number of set bits
-    return pixelByteH & (~H_BYTE_PARITY_INVERT);
-  } else {
-    // Set the parity inversion bit to ensure an odd number of set bits
-    return pixelByteH | H_BYTE_PARITY_INVERT;
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
   }
 }
 
+// This is for the YUV 4:2:0 image processing
+void processYuv420FrameBuffered() {
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
 
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
 
-// Format the low byte of an RGB pixel
-// Ensures that:
-// A: The pixel color is always slightly above 0 (to avoid using 0 as an end-of-line marker)
-// B: An even number of bits are set for the L byte under L_BYTE_PARITY_CHECK and L_BYTE_PARITY_INVERT
-uint8_t formatRgbPixelByteL(uint8_t pixelByteL) {
-  // Check if the parity check bit is set
-  if (pixelByteL & L_BYTE_PARITY_CHECK) {
-    // Set the parity inversion bit and prevent zero value
-    return pixelByteL | L_BYTE_PARITY_INVERT | L_BYTE_PREVENT_ZERO;
-  } else {
-    // Clear the parity inversion bit and prevent zero value
-    return (pixelByteL & (~L_BYTE_PARITY_INVERT)) | L_BYTE_PREVENT_ZERO;
-  }
-}
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
 
+  // Byte range of the region of interest inside a camera line (two bytes per pixel)
+  const uint16_t roiLineStart = roiX * 2;
+  const uint16_t roiLineBytes = roiWidth * 2;
+  const uint16_t roiLineEnd = roiLineStart + roiLineBytes;
+  const uint16_t cameraLineBytes = lineLength * 2;
 
-// This part of code is for UART Communication
-/*
-commandStartNewFrame(uint8_t pixelFormat):
+  // Iterate through each line (height) of the region of interest.
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Even lines keep the chroma, odd lines are luma only
+    const bool isChromaLine = (y & 1) == 0;
+    const uint16_t sendLineBytes = isChromaLine ? roiLineBytes : roiWidth;
 
-This function sends a "new frame" command to the receiving device over UART, indicating the start of a new image frame.
-Here's a breakdown of the steps:
-Command marker: It transmits a new command marker (0x00) to signal the start of a command sequence.
-Command length: It sends the length of the following command data (4 bytes in this case).
-Checksum calculation: It calculates a checksum for error detection during transmission. This involves XOR-ing each command byte with the current checksum value.
-Command data: It sends the following information:
-COMMAND_NEW_FRAME: This constant specifies the "new frame" command type.
-Lower 8 bits of image width (lineLength & 0xFF)
-Lower 8 bits of image height (lineCount & 0xFF)
-A combination of higher 2 bits of width ((lineLength >> 8) & 0x03), higher 2 bits of height ((lineCount >> 6) & 0x0C), and the pixel format ((pixelFormat << 4) & 0xF0) packed into a single byte.
-Checksum byte: Finally, it transmits the calculated checksum for error verification at the receiving end.
+    // Initialize the line buffer send pointer
+    lineBufferSendByte = &lineBuffer[0];
+    lineSendSlotsMissed = 0;
+    lineCrc = 0;
+    // Line starts with the first byte of a pair
+    isLineBufferSendHighByte = true;
 
-commandDebugPrint(const String debugText):
-This function transmits a debug message over UART, typically used for debugging purposes.
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    // Skip the pixels left of the region of interest
+    for (uint16_t x = 0; x < roiLineStart; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    if (isChromaLine) {
+      // Y U Y V
+      for (uint16_t x = 0; x < roiLineBytes; x++) {
+        camera.waitForPixelClockRisingEdge();
+        camera.readPixelByte(lineBuffer[x]);
+        if (isSendWhileBuffering) {
+          tryToSendNextPixelBytePairInBuffer();
+        }
+      }
+    } else {
+      // Y only
+      for (uint16_t x = 0; x < roiWidth; x++) {
+        // Luma byte is stored
+        camera.waitForPixelClockRisingEdge();
+        camera.readPixelByte(lineBuffer[x]);
+        if (isSendWhileBuffering) {
+          tryToSendNextPixelBytePairInBuffer();
+        }
+        // Chroma byte is dropped, the time is used for sending
+        camera.waitForPixelClockRisingEdge();
+        if (isSendWhileBuffering && lineBufferSendByte <= &lineBuffer[x]) {
+          tryToSendNextPixelBytePairInBuffer();
+        }
+      }
+    }
+
+    // Keep sending while the pixels right of the region of interest go by
+    for (uint16_t x = roiLineEnd; x < cameraLineBytes; x++) {
+      camera.waitForPixelClockRisingEdge();
+      if (lineBufferSendByte < &lineBuffer[sendLineBytes]) {
+        tryToSendNextPixelBytePairInBuffer();
+      }
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    // Debug info: Count what is left for the drain below
+    countLineSend(sendLineBytes);
+
+    // Send the remaining part of the line
+    while (lineBufferSendByte < &lineBuffer[sendLineBytes]) {
+      tryToSendNextPixelBytePairInBuffer();
+    }
+
+    if (UART_LINE_CRC) {
+      commandLineCrc();
+    }
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+
+// This is for the lossless coded grayscale processing
+void processLumaFrameCoded() {
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // Time from the end of a QQVGA line to the start of the next one: 4 camera rows of 784 pixels minus one row of
+  // 640 pixels, in pixel clocks of 4 / 8MHz * (pre-scaler + 1), with PLL bypass
+  const uint16_t lumaLineGapTicks = 624UL * (camera.getInternalClockPreScaler() + 1) * Timer1Scheduler::TICKS_PER_MICRO;
+
+  // The two halves of the line buffer take turns as the current line and the line above
+  uint8_t * lumaLine = &lineBuffer[0];
+  uint8_t * lumaLineAbove = &lineBuffer[lineBufferLength / 2];
+
+  // Iterate through each line (height) of the region of interest.
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    // Read the whole line, there is no time to skip pixels and send at the same time
+    for (uint16_t x = 0; x < lineLength; x++) {
+      // Luma byte is stored
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(lumaLine[x]);
+      // Chroma byte is dropped
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    // Code and send the region of interest part of the line.
+    // The first line has no line above it in this frame.
+    uint16_t lineEndCount = Timer1Scheduler::getCount();
+    PROBE_START(PROBE_LINE_CODING);
+    commandLumaLine(&lumaLine[roiX], y > 0 ? &lumaLineAbove[roiX] : 0, roiWidth);
+    PROBE_STOP(PROBE_LINE_CODING);
+    // The next line started before the send had ended, its first pixels are shifted
+    if (Timer1Scheduler::getTicksSince(lineEndCount) > lumaLineGapTicks) {
+      telemetry.lineOverruns++;
+    }
+
+    // Current line becomes the line above
+    uint8_t * swap = lumaLine;
+    lumaLine = lumaLineAbove;
+    lumaLineAbove = swap;
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+
+#if UART_MODE==8
+// This is for the Block Truncation Coding processing
+void processBtcFrame() {
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // Nothing to send yet
+  lineBufferSendByte = &lineBuffer[0];
+  lineBufferSendEnd = &lineBuffer[0];
+
+  // Region of interest height is a multiple of 4
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    uint8_t stripLine = y & 0x03;
+    uint8_t * lumaLine = camera.getStripLine(stripLine);
+
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    for (uint16_t x = 0; x < lineLength; x++) {
+      // Luma byte is stored
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(lumaLine[x]);
+      // Chroma byte is dropped, the time is used to send the previous strip
+      camera.waitForPixelClockRisingEdge();
+      tryToSendNextPacketByte();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    if (stripLine == 0x03) {
+      // The previous strip has to be out before its packets are overwritten
+      while (lineBufferSendByte < lineBufferSendEnd) {
+        tryToSendNextPacketByte();
+      }
+      encodeBtcStrip(y >> 2);
+    }
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+
+  // Send the last strip
+  while (lineBufferSendByte < lineBufferSendEnd) {
+    tryToSendNextPacketByte();
+  }
+}
+#endif
+
+#if UART_MODE==9
+// Edge bits of the middle line of the window, 8 pixels per byte
+const uint8_t EDGE_LINE_LENGTH = 160 / 8;
+uint8_t edgeLine [EDGE_LINE_LENGTH];
+
+// This is for the Sobel edge map processing
+void processEdgeFrame() {
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // The three thirds of the line buffer take turns as the top, middle and bottom line
+  uint8_t * topLine = &lineBuffer[0];
+  uint8_t * middleLine = &lineBuffer[lineBufferLength / 3];
+  uint8_t * bottomLine = &lineBuffer[lineBufferLength / 3 * 2];
+  const int16_t threshold = analysisThreshold;
+
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Edges need the line above and below
+    const bool isWindowFull = y >= 2;
+    // Column sums and differences of the last three columns
+    int16_t s0 = 0, s1 = 0, s2;
+    int16_t d0 = 0, d1 = 0, d2;
+    // Bit of the first pixel is 0, it has no left neighbour
+    uint8_t edgeBits = 0;
+
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    for (uint16_t x = 0; x < lineLength; x++) {
+      // Luma byte is stored
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(bottomLine[x]);
+      // Chroma byte is dropped, the time is used for the kernel
+      camera.waitForPixelClockRisingEdge();
+
+      if (isWindowFull) {
+        s2 = topLine[x] + (middleLine[x] << 1) + bottomLine[x];
+        d2 = bottomLine[x] - topLine[x];
+        if (x >= 2) {
+          // Pixel x - 1 of the middle line
+          int16_t gx = s2 - s0;
+          int16_t gy = d0 + (d1 << 1) + d2;
+          if (gx < 0) gx = -gx;
+          if (gy < 0) gy = -gy;
+          edgeBits = (edgeBits << 1) | (gx + gy > threshold ? 1 : 0);
+          if (((x - 1) & 0x07) == 0x07) {
+            edgeLine[(x - 1) >> 3] = edgeBits;
+          }
+        }
+        s0 = s1; s1 = s2;
+        d0 = d1; d1 = d2;
+      }
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    if (isWindowFull) {
+      // Last pixel has no right neighbour
+      edgeLine[(lineLength - 1) >> 3] = edgeBits << 1;
+      commandEdgeLine(y - 1);
+    }
+
+    // Bottom line becomes the middle line, the top line is reused
+    uint8_t * swap = topLine;
+    topLine = middleLine;
+    middleLine = bottomLine;
+    bottomLine = swap;
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+#endif
+
+// This is for the blob tracker processing
+uint8_t pixelFrameRequestCount = 0; // Frames that are sent with pixels, set by COMMAND_REQUEST_PIXELS
+
+void processBlobFrame() {
+  // Pixels are only sent if the host asked for them
+  const bool isPixelFrame = pixelFrameRequestCount > 0;
+  if (isPixelFrame) {
+    pixelFrameRequestCount--;
+  }
+
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  resetBlobs();
+
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    for (uint16_t x = 0; x < lineLength; x++) {
+      // Luma byte is stored
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(lineBuffer[x]);
+      // Chroma byte is dropped
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    // Runs and blobs of the region of interest part of the line
+    processBlobLine(lineBuffer, roiY + y);
+
+    if (isPixelFrame) {
+      sendLumaLinePacket(LUMA_LINE_RAW, &lineBuffer[roiX], roiWidth);
+    }
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+
+  commandBlobs();
+}
+
+#if UART_MODE==13
+// This is for the projection profile processing
+uint16_t rowProfile [240]; // Sum of every line of the region of interest
+
+void processProfileFrame() {
+  // Column sums use the line buffer
+  uint16_t * columnProfile = (uint16_t *) lineBuffer;
+
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  for (uint16_t x = 0; x < roiWidth; x++) {
+    columnProfile[x] = 0;
+  }
+
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    uint16_t rowSum = 0;
+    uint16_t * columnSum = columnProfile;
+
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    // Skip the pixels left of the region of interest (two bytes per pixel)
+    for (uint16_t x = 0; x < roiX * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    for (uint16_t x = 0; x < roiWidth; x++) {
+      uint8_t luma;
+      // Luma byte goes to the line sum
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(luma);
+      luma >>= 1;
+      rowSum += luma;
+      // Chroma byte is dropped, the time is used for the column sum
+      camera.waitForPixelClockRisingEdge();
+      *columnSum++ += luma;
+    }
+
+    // Skip the pixels right of the region of interest
+    for (uint16_t x = (roiX + roiWidth) * 2; x < lineLength * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    rowProfile[y] = rowSum;
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+
+  commandProfile(PROFILE_ROWS, rowProfile, roiHeight);
+  commandProfile(PROFILE_COLUMNS, columnProfile, roiWidth);
+}
+#endif
+
+// This is for the ordered dither processing
+void processDitherFrame() {
+  // 1 or 2 bits per pixel
+  const uint8_t ditherBits = uartPixelFormat == UART_PIXEL_FORMAT_DITHER2 ? 2 : 1;
+  const uint8_t levelScale = (1 << ditherBits) - 1;
+  const uint8_t pixelsPerByte = 8 / ditherBits;
+
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Thresholds for this line
+    uint8_t ditherRow[4];
+    for (uint8_t i = 0; i < 4; i++) {
+      ditherRow[i] = pgm_read_byte(&ditherMatrix[(roiY + y) & 0x03][i]);
+    }
+
+    // Packet header: marker, length, command code and row
+    uint8_t * out = &lineBuffer[0];
+    uint8_t checksum = 0;
+    *out++ = 0x00;
+    *out++ = 2 + roiWidth / pixelsPerByte;
+    *out = COMMAND_PACKED_LINE; checksum ^= *out++;
+    *out = y; checksum ^= *out++;
+    lineBufferSendByte = &lineBuffer[0];
+    lineBufferSendEnd = out;
+    uint8_t packedBits = 0;
+
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    // Skip the pixels left of the region of interest (two bytes per pixel)
+    for (uint16_t x = 0; x < roiX * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    for (uint16_t x = 0; x < roiWidth; x++) {
+      uint8_t luma;
+      camera.waitForPixelClockRisingEdge();
+      camera.readPixelByte(luma);
+      // Chroma byte is dropped, the time is used to dither and send
+      camera.waitForPixelClockRisingEdge();
+
+      uint8_t level = ((uint16_t)luma * levelScale + ditherRow[x & 0x03]) >> 8;
+      packedBits = (packedBits << ditherBits) | level;
+      if ((x & (pixelsPerByte - 1)) == pixelsPerByte - 1) {
+        *out = packedBits; checksum ^= *out++;
+        lineBufferSendEnd = out;
+      }
+      tryToSendNextPacketByte();
+    }
+
+    // Keep sending while the pixels right of the region of interest go by
+    for (uint16_t x = (roiX + roiWidth) * 2; x < lineLength * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+      tryToSendNextPacketByte();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    // Finish the packet before the next line
+    *out++ = checksum;
+    lineBufferSendEnd = out;
+    while (lineBufferSendByte < lineBufferSendEnd) {
+      tryToSendNextPacketByte();
+    }
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+
+// Send the next byte of the packets in the line buffer if the UART is free
+void tryToSendNextPacketByte() {
+  if (lineBufferSendByte < lineBufferSendEnd && isUartReady()) {
+    UDR0 = *lineBufferSendByte;
+    lineBufferSendByte++;
+  }
+}
+
+// Format and send one byte of a one byte per pixel format if the UART is free
+void tryToSendNextPixelBytePairInBuffer() {
+  // Check if the UART is ready for transmission
+  if (isUartReady()) {
+    // Format the byte on the way out, it is never needed again
+    uint8_t pairByte;
+    if (isLineBufferSendHighByte) {
+      pairByte = formatPixelBytePairFirst(*lineBufferSendByte);
+    } else {
+      pairByte = formatPixelBytePairSecond(*lineBufferSendByte);
+    }
+    UDR0 = pairByte;
+    updateLineCrc(pairByte);
+    // Move the pointer to the next byte in the buffer
+    lineBufferSendByte++;
+    // Toggle between the first and the second byte of a pair
+    isLineBufferSendHighByte = !isLineBufferSendHighByte;
+  } else {
+    lineSendSlotsMissed++;
+  }
+}
+
+
+// 4th function for buffered processing (RGB332 and palette modes)
+void packNextRgbPixelByteInBuffer() {
+  if (isLineBufferSendHighByte) {
+    // Red and green come from the high byte
+    rgb332Pixel = pgm_read_byte(&rgb332FromH[*lineBufferSendByte]);
+  } else {
+    // Blue comes from the low byte, the pixel is complete
+    rgb332Pixel |= pgm_read_byte(&rgb332FromL[*lineBufferSendByte]);
+
+    if (uartPixelFormat == UART_PIXEL_FORMAT_RGB332) {
+      // One pixel per byte
+      packedPixelByte = rgb332Pixel ? rgb332Pixel : RGB332_PREVENT_ZERO;
+      isLineBufferByteFormatted = true;
+    } else {
+      // Look up the palette index (never 0)
+      uint8_t mapByte = paletteMap[rgb332Pixel >> 1];
+      uint8_t paletteIndex = (rgb332Pixel & 1) ? (mapByte & 0x0F) : (mapByte >> 4);
+      if (isPackedPixelLowNibble) {
+        // Second pixel completes the byte
+        packedPixelByte |= paletteIndex;
+        isLineBufferByteFormatted = true;
+      } else {
+        packedPixelByte = paletteIndex << 4;
+      }
+      isPackedPixelLowNibble = !isPackedPixelLowNibble;
+    }
+  }
+
+  // The buffer byte has been used
+  lineBufferSendByte++;
+
+  // Toggle the flag for the next byte (high or low)
+  isLineBufferSendHighByte = !isLineBufferSendHighByte;
+}
+
+
+/// This is for the direct image processing
+void processRgbFrameDirect() {
+  // Wait for the vertical sync signal (Vsync)
+  camera.waitForVsync();
+
+  // Ignore any vertical padding (if present)
+  camera.ignoreVerticalPadding();
+
+  // Skip the lines above the region of interest
+  camera.ignoreLines(roiY);
+
+  // Iterate through each line (height) of the region of interest
+  for (uint16_t y = 0; y < roiHeight; y++) {
+    // Ignore any left horizontal padding
+    camera.ignoreHorizontalPaddingLeft();
+
+    // Skip the pixels left of the region of interest (two bytes per pixel)
+    for (uint16_t x = 0; x < roiX * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Iterate through each pixel in the region of interest (width)
+    for (uint16_t x = 0; x < roiWidth; x++) {
+      // Wait for the rising edge of the pixel clock
+      camera.waitForPixelClockRisingEdge();
+      // Read the pixel byte from the camera
+      camera.readPixelByte(lineBuffer[0]);
+      // Format the high byte of the RGB pixel
+      lineBuffer[0] = formatRgbPixelByteH(lineBuffer[0]);
+      // Wait for the previous UART byte to be sent
+      waitForPreviousUartByteToBeSent();
+      // Send the formatted high byte over UART
+      UDR0 = lineBuffer[0];
+
+      // Wait for the rising edge of the pixel clock
+      camera.waitForPixelClockRisingEdge();
+      // Read the pixel byte from the camera
+      camera.readPixelByte(lineBuffer[0]);
+      // Format the low byte of the RGB pixel
+      lineBuffer[0] = formatRgbPixelByteL(lineBuffer[0]);
+      // Wait for the previous UART byte to be sent
+      waitForPreviousUartByteToBeSent();
+      // Send the formatted low byte over UART
+      UDR0 = lineBuffer[0];
+    }
+
+    // Skip the pixels right of the region of interest
+    for (uint16_t x = (roiX + roiWidth) * 2; x < lineLength * 2; x++) {
+      camera.waitForPixelClockRisingEdge();
+    }
+
+    // Ignore any right horizontal padding
+    camera.ignoreHorizontalPaddingRight();
+
+    // Host bytes that came in during the line, the UART only holds two
+    pollHostCommandBytes();
+  }
+}
+
+
+// This part of code is for pixel formatting
+/*
+formatRgbPixelByteH(uint8_t pixelByteH):
+
+This function formats the high byte of an RGB pixel for transmission over UART.
+It ensures two things:
+Non-zero color value: It guarantees the pixel value is always slightly above zero by using the L_BYTE_PREVENT_ZERO constant. This is because zero is often used as an end-of-line marker in UART communication.
+Odd parity: It verifies if an odd number of bits are set in the high byte using the H_BYTE_PARITY_CHECK constant. It then adjusts the parity bit (H_BYTE_PARITY_INVERT) to maintain an odd number of set bits for error detection during transmission.
+
+formatPixelBytePairFirst / formatPixelBytePairSecond(uint8_t pixelByte):
+Format one byte per pixel data (raw Bayer, YUV). The lowest bit is replaced with a pair marker (0 for the first, 1 for the second byte)
+and a first byte that would be zero is sent as 2. The host uses the marker to find the pair alignment and the Bayer phase.
+
+formatRgbPixelByteL(uint8_t pixelByteL):
+This function formats the low byte of an RGB pixel for UART transmission.
+Similar to the high byte function, it ensures:
+Non-zero color value: The pixel value is kept slightly above zero using L_BYTE_PREVENT_ZERO.
+Even parity: It checks if an even number of bits are set in the low byte using L_BYTE_PARITY_CHECK and adjusts the parity bit (L_BYTE_PARITY_INVERT) to achieve even parity.
+*/
+
+// Format the high byte of an RGB pixel
+// Ensures that:
+// A: The pixel color is always slightly above 0 (since zero is an end-of-line marker)
+// B: An odd number of bits are set for the H byte under H_BYTE_PARITY_CHECK and H_BYTE_PARITY_INVERT
+uint8_t formatRgbPixelByteH(uint8_t pixelByteH) {
+  // Check if the parity check bit is set
+  if (pixelByteH & H_BYTE_PARITY_CHECK) {
+    // Clear the parity inversion bit to maintain an odd number of set bits
+    return pixelByteH & (~H_BYTE_PARITY_INVERT);
+  } else {
+    // Set the parity inversion bit to ensure an odd number of set bits
+    return pixelByteH | H_BYTE_PARITY_INVERT;
+  }
+}
+
+
+
+// Format the low byte of an RGB pixel
+// Ensures that:
+// A: The pixel color is always slightly above 0 (to avoid using 0 as an end-of-line marker)
+// B: An even number of bits are set for the L byte under L_BYTE_PARITY_CHECK and L_BYTE_PARITY_INVERT
+uint8_t formatRgbPixelByteL(uint8_t pixelByteL) {
+  // Check if the parity check bit is set
+  if (pixelByteL & L_BYTE_PARITY_CHECK) {
+    // Set the parity inversion bit and prevent zero value
+    return pixelByteL | L_BYTE_PARITY_INVERT | L_BYTE_PREVENT_ZERO;
+  } else {
+    // Clear the parity inversion bit and prevent zero value
+    return (pixelByteL & (~L_BYTE_PARITY_INVERT)) | L_BYTE_PREVENT_ZERO;
+  }
+}
+
+
+// Format the first byte of a pair: lowest bit 0, never zero
+uint8_t formatPixelBytePairFirst(uint8_t pixelByte) {
+  // Clear the pair marker bit
+  pixelByte &= ~PAIR_BYTE_MARKER;
+  // 0 would be a command marker
+  return pixelByte ? pixelByte : PAIR_BYTE_PREVENT_ZERO;
+}
+
+// Format the second byte of a pair: lowest bit 1, so it is never zero
+uint8_t formatPixelBytePairSecond(uint8_t pixelByte) {
+  return pixelByte | PAIR_BYTE_MARKER;
+}
+
+
+// This part of code is for lossless line coding
+/*
+commandLumaLine(line, lineAbove, length):
+Sends one grayscale line as COMMAND_LUMA_LINE: command code, coding byte, coded data.
+Coding byte: bits 0..1 line coding, bits 4..6 Rice parameter k.
+Coded data is allowed to contain 0 bytes since the packet has a length.
+
+Line codings:
+LUMA_LINE_RAW: The pixel values as they are.
+LUMA_LINE_RUN_LENGTH: Pairs of run length (1..255) and pixel value.
+LUMA_LINE_LEFT: Each pixel is predicted from the pixel on its left (128 for the first pixel).
+LUMA_LINE_ABOVE: Each pixel is predicted from the same pixel in the line above.
+For both DPCM codings the residual (pixel - prediction, 8-bit wrap around) is zigzag mapped to 0..255
+(0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...) and Golomb-Rice coded with parameter k, most significant bit first:
+q = value >> k one bits, a zero bit, then the lowest k bits of the value.
+If q is LUMA_RICE_ESCAPE or more, LUMA_RICE_ESCAPE one bits are followed by the 8-bit value instead.
+The last byte is padded with zero bits. The host knows the line length from COMMAND_NEW_FRAME.
+
+selectLumaLineCoding(line, lineAbove, length):
+Picks the coding from cheap size estimates, without coding the line:
+run length is 16 bits per run,
+DPCM is about length * (k + 1) + sum(value) >> k bits with k chosen from the mean residual.
+A coding is only tried if the estimate is below 4 bits per pixel, otherwise the line is sent raw right away.
+The estimate loop is a few instructions per pixel.
+
+encodeLumaLineRunLength / encodeLumaLineRice:
+Write the coded line into codedLineBuffer. Coding stops as soon as the coded line would be longer than half
+of the raw line, so at most length * 4 bits are written whatever the residuals are.
+In that case the raw line is sent instead, so a line never takes more time on the link than before.
+
+Time budget at 2Mbaud and pre-scaler 2 (QQVGA line gap of 624 * 3us, about 29900 cycles):
+selection about 4500 cycles, coding 640 bits of 160 pixels at about 15 cycles per bit,
+then the raw send of 164 bytes, about 13100 cycles, if coding gave up at the last pixel.
+Lines that still run into the next line are counted in telemetry.lineOverruns.
+*/
+
+const uint8_t LUMA_RICE_MAX_K = 7; // Largest Rice parameter
+const uint8_t LUMA_RICE_ESCAPE = 8; // Longest unary part before the value is sent as it is
+const uint8_t LUMA_CODED_LINE_MAX_LENGTH = 80; // A coded line is at most half of a raw QQVGA line
+
+uint8_t codedLineBuffer [LUMA_CODED_LINE_MAX_LENGTH]; // Coded line data
+uint8_t codedLineLength; // Number of complete bytes in codedLineBuffer
+uint8_t codedLineLimit; // Coding gives up at this length
+uint8_t codedBits; // Bits of the byte that is being filled
+uint8_t codedBitCount; // Number of bits in codedBits
+
+// Append one bit to the coded line. Returns false if the line got too long.
+inline bool putCodedBit(uint8_t bit) __attribute__((always_inline));
+bool putCodedBit(uint8_t bit) {
+  codedBits = (codedBits << 1) | bit;
+  if (++codedBitCount == 8) {
+    if (codedLineLength >= codedLineLimit) {
+      return false;
+    }
+    codedLineBuffer[codedLineLength++] = codedBits;
+    codedBitCount = 0;
+  }
+  return true;
+}
+
+// Send one grayscale line, coded if that makes it shorter
+void commandLumaLine(const uint8_t * line, const uint8_t * lineAbove, uint8_t length) {
+  uint8_t coding = selectLumaLineCoding(line, lineAbove, length);
+  uint8_t lineCoding = coding & 0x03;
+  const uint8_t * data = codedLineBuffer;
+
+  // Coding must end up at most half of the raw line, which is also strictly shorter.
+  // This bounds the coding time as well as the buffer.
+  codedLineLimit = length / 2 < LUMA_CODED_LINE_MAX_LENGTH ? length / 2 : LUMA_CODED_LINE_MAX_LENGTH;
+  bool isCoded = false;
+  if (lineCoding == LUMA_LINE_RUN_LENGTH) {
+    isCoded = encodeLumaLineRunLength(line, length);
+  } else if (lineCoding == LUMA_LINE_LEFT) {
+    isCoded = encodeLumaLineRice(line, 0, length, coding >> 4);
+  } else if (lineCoding == LUMA_LINE_ABOVE) {
+    isCoded = encodeLumaLineRice(line, lineAbove, length, coding >> 4);
+  }
+
+  if (!isCoded) {
+    coding = LUMA_LINE_RAW;
+    data = line;
+    codedLineLength = length;
+  }
+
+  sendLumaLinePacket(coding, data, codedLineLength);
+}
+
+// Send COMMAND_LUMA_LINE with line data that has already been coded
+void sendLumaLinePacket(uint8_t coding, const uint8_t * data, uint8_t length) {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Command code, coding byte and the data
+  waitForPreviousUartByteToBeSent();
+  UDR0 = length + 2;
+
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_LUMA_LINE);
+  checksum = sendNextCommandByte(checksum, coding);
+  for (uint8_t i = 0; i < length; i++) {
+    checksum = sendNextCommandByte(checksum, data[i]);
+  }
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+// Pick the line coding that is likely to give the shortest line
+uint8_t selectLumaLineCoding(const uint8_t * line, const uint8_t * lineAbove, uint8_t length) {
+  uint16_t runCount = 1;
+  uint16_t leftSum = 0; // Sum of absolute residuals
+  uint16_t aboveSum = 0;
+  uint8_t previous = 128; // Prediction of the first pixel
+
+  for (uint8_t x = 0; x < length; x++) {
+    int8_t residual = line[x] - previous;
+    leftSum += residual < 0 ? -residual : residual;
+    if (x > 0 && residual != 0) {
+      runCount++;
+    }
+    previous = line[x];
+  }
+
+  if (lineAbove) {
+    for (uint8_t x = 0; x < length; x++) {
+      int8_t residual = line[x] - lineAbove[x];
+      aboveSum += residual < 0 ? -residual : residual;
+    }
+  }
+
+  // Size estimates in bits, a coding has to beat half of the raw line
+  uint8_t bestCoding = LUMA_LINE_RAW;
+  uint16_t bestBits = length * 4;
+
+  if (runCount * 16 < bestBits) {
+    bestCoding = LUMA_LINE_RUN_LENGTH;
+    bestBits = runCount * 16;
+  }
+
+  // Zigzag values are about twice the absolute residual
+  for (uint8_t coding = LUMA_LINE_LEFT; coding <= LUMA_LINE_ABOVE; coding++) {
+    if (coding == LUMA_LINE_ABOVE && !lineAbove) {
+      break;
+    }
+    uint16_t valueSum = (coding == LUMA_LINE_LEFT ? leftSum : aboveSum) * 2;
+    // 2^k close to the mean value
+    uint8_t k = 0;
+    while (k < LUMA_RICE_MAX_K && ((uint16_t)length << (k + 1)) <= valueSum) {
+      k++;
+    }
+    uint16_t bits = length * (k + 1) + (valueSum >> k);
+    if (bits < bestBits) {
+      bestCoding = coding | (k << 4);
+      bestBits = bits;
+    }
+  }
+
+  return bestCoding;
+}
+
+// Run length coding: run length and value pairs
+bool encodeLumaLineRunLength(const uint8_t * line, uint8_t length) {
+  codedLineLength = 0;
+  uint8_t x = 0;
+  while (x < length) {
+    uint8_t value = line[x];
+    uint8_t runLength = 1;
+    while (x + runLength < length && line[x + runLength] == value && runLength < 255) {
+      runLength++;
+    }
+    if (codedLineLength + 2 > codedLineLimit) {
+      return false;
+    }
+    codedLineBuffer[codedLineLength++] = runLength;
+    codedLineBuffer[codedLineLength++] = value;
+    x += runLength;
+  }
+  return true;
+}
+
+// DPCM + Rice coding. Prediction from the left if lineAbove is 0.
+bool encodeLumaLineRice(const uint8_t * line, const uint8_t * lineAbove, uint8_t length, uint8_t k) {
+  codedLineLength = 0;
+  codedBits = 0;
+  codedBitCount = 0;
+  uint8_t previous = 128;
+
+  for (uint8_t x = 0; x < length; x++) {
+    uint8_t prediction = lineAbove ? lineAbove[x] : previous;
+    int8_t residual = line[x] - prediction;
+    // Zigzag: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...
+    uint8_t value = ((uint8_t)residual << 1) ^ (uint8_t)(residual >> 7);
+    uint8_t q = value >> k;
+    previous = line[x];
+
+    if (q < LUMA_RICE_ESCAPE) {
+      // Unary part, stop bit and the low bits
+      for (uint8_t i = 0; i < q; i++) {
+        if (!putCodedBit(1)) return false;
+      }
+      if (!putCodedBit(0)) return false;
+      // Low bits from the top of the byte, a variable shift per bit would be a loop on AVR
+      uint8_t low = value << (8 - k);
+      for (uint8_t i = k; i > 0; i--) {
+        if (!putCodedBit(low >> 7)) return false;
+        low <<= 1;
+      }
+    } else {
+      // Escape and the whole value
+      for (uint8_t i = 0; i < LUMA_RICE_ESCAPE; i++) {
+        if (!putCodedBit(1)) return false;
+      }
+      for (uint8_t i = 8; i > 0; i--) {
+        if (!putCodedBit(value >> 7)) return false;
+        value <<= 1;
+      }
+    }
+  }
+
+  // Pad the last byte with zero bits
+  while (codedBitCount > 0) {
+    if (!putCodedBit(0)) return false;
+  }
+  return true;
+}
+
+
+// This part of code is for Block Truncation Coding
+/*
+encodeBtcStrip(stripIndex):
+Codes the 4 lines in the strip buffer (region of interest columns only) into complete COMMAND_BTC_BLOCKS packets
+in the line buffer: 0x00, length, command code, strip index, index of the first block in the strip, blocks, checksum.
+A strip of 160 pixels is 40 blocks, sent as one packet.
+
+Each 4x4 block is 4 bytes: low level, high level and a 16-bit mask (high byte first).
+Mask bits go row by row, most significant bit is the top left pixel. A set bit means the pixel is above the block mean
+and is shown with the high level. The levels are the means of the pixels below and above the block mean,
+which keeps the block mean (absolute moment BTC). 2 bits per pixel, 8 times less than RGB565.
+Levels and masks can be 0, which is fine inside a packet.
+
+Divisions by the pixel count are done with a table of reciprocals, a 16-bit division would not fit between two lines.
+*/
+
+const uint8_t BTC_BLOCKS_PER_PACKET = 40; // Keeps the packet length below 256
+#define BTC_RECIPROCAL(n) ((uint16_t)((65536UL + (n) / 2) / (n)))
+const uint16_t btcReciprocal[17] PROGMEM = {
+    0, 0xFFFF, BTC_RECIPROCAL(2), BTC_RECIPROCAL(3), BTC_RECIPROCAL(4), BTC_RECIPROCAL(5), BTC_RECIPROCAL(6),
+    BTC_RECIPROCAL(7), BTC_RECIPROCAL(8), BTC_RECIPROCAL(9), BTC_RECIPROCAL(10), BTC_RECIPROCAL(11),
+    BTC_RECIPROCAL(12), BTC_RECIPROCAL(13), BTC_RECIPROCAL(14), BTC_RECIPROCAL(15), BTC_RECIPROCAL(16)
+};
+
+#if UART_MODE==8
+void encodeBtcStrip(uint8_t stripIndex) {
+  uint8_t * out = &lineBuffer[0];
+  const uint8_t firstBlock = roiX >> 2;
+  const uint8_t blockCount = roiWidth >> 2;
+
+  for (uint8_t packetStart = 0; packetStart < blockCount; packetStart += BTC_BLOCKS_PER_PACKET) {
+    uint8_t packetBlockCount = blockCount - packetStart;
+    if (packetBlockCount > BTC_BLOCKS_PER_PACKET) packetBlockCount = BTC_BLOCKS_PER_PACKET;
+
+    // Command marker and length (command code, strip index, first block and the blocks)
+    *out++ = 0x00;
+    *out++ = 3 + packetBlockCount * 4;
+    uint8_t checksum = 0;
+    *out = COMMAND_BTC_BLOCKS; checksum ^= *out++;
+    *out = stripIndex; checksum ^= *out++;
+    *out = packetStart; checksum ^= *out++;
+
+    for (uint8_t block = 0; block < packetBlockCount; block++) {
+      const uint16_t x = (firstBlock + packetStart + block) << 2;
+
+      // Block mean
+      uint16_t sum = 0;
+      for (uint8_t row = 0; row < 4; row++) {
+        const uint8_t * pixels = camera.getStripLine(row) + x;
+        sum += pixels[0] + pixels[1] + pixels[2] + pixels[3];
+      }
+      const uint8_t mean = sum >> 4;
+
+      // Mask and the sum of the pixels above the mean
+      uint16_t mask = 0;
+      uint16_t highSum = 0;
+      uint8_t highCount = 0;
+      for (uint8_t row = 0; row < 4; row++) {
+        const uint8_t * pixels = camera.getStripLine(row) + x;
+        for (uint8_t i = 0; i < 4; i++) {
+          mask <<= 1;
+          if (pixels[i] > mean) {
+            mask |= 1;
+            highSum += pixels[i];
+            highCount++;
+          }
+        }
+      }
+
+      // Mean of both groups, rounded
+      const uint8_t lowCount = 16 - highCount;
+      uint8_t low = lowCount ? ((uint32_t)(sum - highSum) * pgm_read_word(&btcReciprocal[lowCount]) + 0x8000) >> 16 : mean;
+      uint8_t high = highCount ? ((uint32_t)highSum * pgm_read_word(&btcReciprocal[highCount]) + 0x8000) >> 16 : mean;
+
+      *out = low; checksum ^= *out++;
+      *out = high; checksum ^= *out++;
+      *out = mask >> 8; checksum ^= *out++;
+      *out = mask & 0xFF; checksum ^= *out++;
+    }
+
+    *out++ = checksum;
+  }
+
+  // Sent while the next strip is read
+  lineBufferSendByte = &lineBuffer[0];
+  lineBufferSendEnd = out;
+}
+#endif
+
+
+// This part of code is for the edge map
+/*
+commandEdgeLine(row):
+Sends COMMAND_PACKED_LINE: command code, row inside the region of interest, then the edge bits of the row
+(8 pixels per byte, leftmost pixel in the most significant bit). The first and the last row of the region of interest
+have no edge map, so rows 1 to height - 2 are sent. The whole camera line is filtered, so the pixels at the left and right
+edge of the region of interest use their neighbours outside of it. Only the first and the last pixel of the camera line
+have no neighbour and are always 0.
+In the edge mode x and width of the region of interest are multiples of 8.
+A 160 pixel row is 20 bytes instead of 320 bytes in RGB565.
+*/
+
+#if UART_MODE==9
+void commandEdgeLine(uint8_t row) {
+  const uint8_t firstByte = roiX >> 3;
+  const uint8_t byteCount = roiWidth >> 3;
+
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Command code, row and the edge bits
+  waitForPreviousUartByteToBeSent();
+  UDR0 = byteCount + 2;
+
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_PACKED_LINE);
+  checksum = sendNextCommandByte(checksum, row);
+  for (uint8_t i = 0; i < byteCount; i++) {
+    checksum = sendNextCommandByte(checksum, edgeLine[firstByte + i]);
+  }
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+#endif
+
+
+// This part of code is for the blob tracker
+/*
+processBlobLine(line, y):
+Finds the runs of pixels above analysisThreshold inside the region of interest.
+Every run that touches a run of the line above (also diagonally) joins its blob. A run that touches runs of two different blobs
+merges the blobs (the merged blob points to the one it was merged into, findBlob follows these links).
+A run that touches nothing starts a new blob. When BLOB_MAX_COUNT blobs are in use, new blobs are dropped
+and when a line has more than BLOB_MAX_RUN_COUNT runs the rest of the line is ignored.
+A blob keeps its bounding box, area and the sums of the x and y coordinates of its pixels.
+The work per line is linear in the number of runs, since the runs of both lines are sorted by x.
+
+commandBlobs():
+Sends COMMAND_BLOBS: command code, blob count, then 8 bytes per blob with at least BLOB_MIN_AREA pixels:
+min x, min y, max x, max y, centroid x, centroid y (frame coordinates), area (16-bit little endian).
+With at most 16 blobs the packet is 130 bytes.
+
+Only a luma threshold is used. A frame difference would need the previous frame, which does not fit into the SRAM.
+*/
+
+const uint8_t BLOB_MAX_COUNT = 16; // Blobs per frame
+const uint8_t BLOB_MAX_RUN_COUNT = 24; // Runs per line
+const uint16_t BLOB_MIN_AREA = 4; // Smaller blobs are treated as noise
+const uint8_t BLOB_NONE = 0xFF; // Run without a blob
+
+struct Blob {
+  uint8_t minX;
+  uint8_t minY;
+  uint8_t maxX;
+  uint8_t maxY;
+  uint16_t area;
+  uint32_t sumX;
+  uint32_t sumY;
+};
+
+struct BlobRun {
+  uint8_t start;
+  uint8_t end;
+  uint8_t blob;
+};
+
+Blob blobs [BLOB_MAX_COUNT];
+uint8_t blobParent [BLOB_MAX_COUNT]; // Blob that this blob was merged into, itself if not merged
+uint8_t blobCount;
+BlobRun blobRuns [2][BLOB_MAX_RUN_COUNT]; // Runs of the current line and the line above
+uint8_t blobRunCount [2];
+uint8_t blobRunLine; // Index of the current line in blobRuns
+
+void resetBlobs() {
+  blobCount = 0;
+  blobRunCount[0] = 0;
+  blobRunCount[1] = 0;
+  blobRunLine = 0;
+}
+
+// Follow the merge links to the blob that holds the pixels
+uint8_t findBlob(uint8_t blob) {
+  while (blobParent[blob] != blob) {
+    blob = blobParent[blob];
+  }
+  return blob;
+}
+
+// Move everything from blob "from" to blob "to"
+void mergeBlobs(uint8_t to, uint8_t from) {
+  Blob & a = blobs[to];
+  const Blob & b = blobs[from];
+  if (b.minX < a.minX) a.minX = b.minX;
+  if (b.minY < a.minY) a.minY = b.minY;
+  if (b.maxX > a.maxX) a.maxX = b.maxX;
+  if (b.maxY > a.maxY) a.maxY = b.maxY;
+  a.area += b.area;
+  a.sumX += b.sumX;
+  a.sumY += b.sumY;
+  blobParent[from] = to;
+}
+
+void processBlobLine(const uint8_t * line, uint8_t y) {
+  const uint8_t threshold = analysisThreshold > 0xFF ? 0xFF : analysisThreshold;
+  const uint8_t lineAbove = blobRunLine;
+  blobRunLine ^= 1;
+  BlobRun * runs = blobRuns[blobRunLine];
+  const BlobRun * runsAbove = blobRuns[lineAbove];
+  const uint8_t runAboveCount = blobRunCount[lineAbove];
+  uint8_t runCount = 0;
+
+  // Runs of the line
+  const uint8_t xEnd = roiX + roiWidth;
+  uint8_t x = roiX;
+  while (x < xEnd && runCount < BLOB_MAX_RUN_COUNT) {
+    if (line[x] > threshold) {
+      runs[runCount].start = x;
+      while (x < xEnd && line[x] > threshold) {
+        x++;
+      }
+      runs[runCount].end = x - 1;
+      runCount++;
+    } else {
+      x++;
+    }
+  }
+  blobRunCount[blobRunLine] = runCount;
+
+  // Join the runs with the runs of the line above
+  uint8_t firstRunAbove = 0;
+  for (uint8_t i = 0; i < runCount; i++) {
+    BlobRun & run = runs[i];
+    uint8_t blob = BLOB_NONE;
+
+    // Runs above that end left of this run can't touch the following runs either
+    while (firstRunAbove < runAboveCount && runsAbove[firstRunAbove].end + 1 < run.start) {
+      firstRunAbove++;
+    }
+    for (uint8_t j = firstRunAbove; j < runAboveCount && runsAbove[j].start <= run.end + 1; j++) {
+      if (runsAbove[j].blob == BLOB_NONE) {
+        continue;
+      }
+      uint8_t blobAbove = findBlob(runsAbove[j].blob);
+      if (blob == BLOB_NONE) {
+        blob = blobAbove;
+      } else if (blobAbove != blob) {
+        mergeBlobs(blob, blobAbove);
+      }
+    }
+
+    if (blob == BLOB_NONE) {
+      if (blobCount == BLOB_MAX_COUNT) {
+        run.blob = BLOB_NONE;
+        continue;
+      }
+      // New blob
+      blob = blobCount++;
+      blobParent[blob] = blob;
+      blobs[blob].minX = run.start;
+      blobs[blob].maxX = run.end;
+      blobs[blob].minY = y;
+      blobs[blob].maxY = y;
+      blobs[blob].area = 0;
+      blobs[blob].sumX = 0;
+      blobs[blob].sumY = 0;
+    }
+
+    // Add the run to the blob
+    Blob & b = blobs[blob];
+    uint8_t runLength = run.end - run.start + 1;
+    if (run.start < b.minX) b.minX = run.start;
+    if (run.end > b.maxX) b.maxX = run.end;
+    if (y > b.maxY) b.maxY = y;
+    b.area += runLength;
+    b.sumX += (uint16_t)(run.start + run.end) * runLength / 2;
+    b.sumY += (uint16_t)y * runLength;
+    run.blob = blob;
+  }
+}
+
+void commandBlobs() {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < blobCount; i++) {
+    if (blobParent[i] == i && blobs[i].area >= BLOB_MIN_AREA) {
+      count++;
+    }
+  }
+
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Command code, blob count and the blobs
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 2 + count * 8;
+
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_BLOBS);
+  checksum = sendNextCommandByte(checksum, count);
+  for (uint8_t i = 0; i < blobCount; i++) {
+    const Blob & b = blobs[i];
+    if (blobParent[i] == i && b.area >= BLOB_MIN_AREA) {
+      checksum = sendNextCommandByte(checksum, b.minX);
+      checksum = sendNextCommandByte(checksum, b.minY);
+      checksum = sendNextCommandByte(checksum, b.maxX);
+      checksum = sendNextCommandByte(checksum, b.maxY);
+      checksum = sendNextCommandByte(checksum, b.sumX / b.area); // Centroid x
+      checksum = sendNextCommandByte(checksum, b.sumY / b.area); // Centroid y
+      checksum = sendNextCommandByte(checksum, b.area & 0xFF);
+      checksum = sendNextCommandByte(checksum, b.area >> 8);
+    }
+  }
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+
+// This part of code is for the projection profiles
+/*
+commandProfile(profile, sums, count):
+Sends a profile as COMMAND_PROFILE packets of up to PROFILE_VALUES_PER_PACKET sums:
+command code, profile (PROFILE_ROWS or PROFILE_COLUMNS), index of the first sum (16-bit little endian),
+then the sums (16-bit little endian). A sum is the sum of Y / 2 over a line or a column of the region of interest.
+*/
+
+const uint8_t PROFILE_VALUES_PER_PACKET = 120; // Keeps the packet length below 256
+
+void commandProfile(uint8_t profile, const uint16_t * sums, uint16_t count) {
+  for (uint16_t first = 0; first < count; first += PROFILE_VALUES_PER_PACKET) {
+    uint8_t packetCount = count - first < PROFILE_VALUES_PER_PACKET ? count - first : PROFILE_VALUES_PER_PACKET;
+
+    // Send the new command marker (0x00)
+    waitForPreviousUartByteToBeSent();
+    UDR0 = 0x00;
+
+    // Command code, profile, first index and the sums
+    waitForPreviousUartByteToBeSent();
+    UDR0 = 4 + packetCount * 2;
+
+    uint8_t checksum = 0;
+    checksum = sendNextCommandByte(checksum, COMMAND_PROFILE);
+    checksum = sendNextCommandByte(checksum, profile);
+    checksum = sendNextCommandByte(checksum, first & 0xFF);
+    checksum = sendNextCommandByte(checksum, first >> 8);
+    for (uint8_t i = 0; i < packetCount; i++) {
+      checksum = sendNextCommandByte(checksum, sums[first + i] & 0xFF);
+      checksum = sendNextCommandByte(checksum, sums[first + i] >> 8);
+    }
+
+    // Send the checksum byte
+    waitForPreviousUartByteToBeSent();
+    UDR0 = checksum;
+  }
+}
+
+
+// This part of code is for UART Communication
+/*
+commandStartNewFrame(uint8_t pixelFormat):
+
+This function sends a "new frame" command to the receiving device over UART, indicating the start of a new image frame.
+Here's a breakdown of the steps:
+Command marker: It transmits a new command marker (0x00) to signal the start of a command sequence.
+Command length: It sends the length of the following command data (4 bytes in this case).
+Checksum calculation: It calculates a checksum for error detection during transmission. This involves XOR-ing each command byte with the current checksum value.
+Command data: It sends the following information:
+COMMAND_NEW_FRAME: This constant specifies the "new frame" command type.
+Lower 8 bits of image width (lineLength & 0xFF)
+Lower 8 bits of image height (lineCount & 0xFF)
+A combination of higher 2 bits of width ((lineLength >> 8) & 0x03), higher 2 bits of height ((lineCount >> 6) & 0x0C), and the pixel format ((pixelFormat << 4) & 0xF0) packed into a single byte.
+Width and height are the size of the region of interest, which is the full frame unless the host selected a smaller one.
+The origin of the region of interest follows: lower 8 bits of x, lower 8 bits of y, and the higher 2 bits of x and y packed the same way as width and height.
+Checksum byte: Finally, it transmits the calculated checksum for error verification at the receiving end.
+
+commandStatus(isCameraOk, cameraReadyMillis, firstFrameMillis):
+Sends COMMAND_STATUS with one byte camera ok flag (1 or 0) and two 16-bit little endian times in milliseconds since power on:
+when the camera was ready and when the first frame started (0 while no frame has started yet).
+
+commandDebugPrint(const String debugText):
+This function transmits a debug message over UART, typically used for debugging purposes.
 It follows a similar structure to commandStartNewFrame:
 Command marker: Sends a new command marker (0x00).
 Command length: Sends the total length of the debug text message (including the command code).
@@ -628,26 +2458,298 @@ It checks the UDRE0 bit (USART Data Register Empty) in the UCSR0A register to de
 isUartReady():
 This function checks if the UART is ready to transmit another byte.
 It returns true if the UDRE0 bit (USART Data Register
+
+processHostCommands():
+Reads the bytes the host has sent since the last frame and feeds them through a small state machine.
+Host commands use the same framing as the commands above (0x00, length, command bytes, checksum).
+It is only called from processFrame() between frames with interrupts enabled, since setCameraResolution writes camera
+registers over Wire and waits for vsync.
+RX window: from the last line of the region of interest until the first line of the next frame interrupts are enabled
+and the Serial interrupt receives every byte. This is at least the vertical blanking, so a command that the host sends
+right after the last line of a frame is applied before the next frame.
+During the frame pollHostCommandBytes takes the received bytes from the UART in the gap after every line, a command
+completed there is executed after the frame. The UART only holds two bytes, so a host that sends outside of the
+RX window has to send at most two bytes per line.
+The host can see whether a command was applied from the next COMMAND_NEW_FRAME (for example the ROI origin) and resend it if needed.
+
+setCameraResolution(resolution):
+Calls camera.reconfigure() which writes only the registers that differ between the current and the new resolution
+during vertical blanking and skips the one frame that may still be in the old resolution.
+lineLength, lineCount and the region of interest are updated right after it, before the next frame is captured.
+
+setRegionOfInterest(x, y, width, height):
+Clamps the requested rectangle to the frame. With raw Bayer the origin is rounded down to even values to keep the color pattern.
+With Block Truncation Coding the region is aligned to 4x4 blocks, in the edge and dither modes x and width are multiples of 8.
+With YUV 4:2:0 and the palette mode x and width are made even, so every Y U Y V group and every palette byte is complete.
+The capture loop only reads and sends the pixels inside it, so a 64x64 region takes a fraction of the link time
+of a full 320x240 frame. No camera reset is needed to move it.
+Lines above the region are only counted and the frame ends after its last line. In the modes where the link is the limit
+(1 to 4) the camera clock follows the width (setClockPreScalerForRegionOfInterest), so a narrow region gets a higher
+frame rate. The exposure control follows the shorter rows within a few frames.
+
+commandFrameHeader(pixelFormat):
+Version 2 frame header, sent instead of COMMAND_NEW_FRAME when FRAME_HEADER_VERSION is 2. Fixed size, all values little endian:
+sequence number (16 bit, frameCounter), micros() at vsync (32 bit), x, y, width, height (16 bit each), pixel format,
+servo angle in degrees, exposure in rows and gain in 1/16 steps (16 bit each, 0 when the camera's own AEC/AGC is used).
+A gap in the sequence number is a dropped frame. Frames skipped for the servo are not counted.
+micros() does not advance while interrupts are disabled for the capture, so the timestamp is only exact between frames captured back to back.
+
+commandLineCrc():
+Only with UART_LINE_CRC. Sent after every line of the buffered RGB, Bayer and YUV modes with the CRC-8 (polynomial 0x07,
+initial value 0) of the pixel bytes of the line as they were sent, so the host checks the bytes it received since the
+previous command. The CRC is updated with one table read in the send slot of the capture loop.
+
+commandFrameEnd():
+Only with UART_LINE_CRC. Sent after every frame with the sequence number of its frame header, the number of line CRCs
+and the CRC-16 (XMODEM) of those line CRCs. A line CRC command that was lost on the link shows up as a frame CRC error
+even when all other lines were correct. tools/link_statistics.py turns these into loss and corruption rates per link.
+The modes without line CRCs send the command with 0 lines.
+
+commandProbe(probe):
+Only with PROBES_ENABLED (Probes.h). Sent for every probe after COMMAND_TELEMETRY: probe id, count, min, max and mean
+in microseconds (32-bit) and the log2 histogram (16-bit bins, bin n = 2^(n-1) .. 2^n - 1 us). The statistics are reset
+after each record, so they cover the frames since the previous one.
+
+commandDebugLog(id, arguments...):
+Sent by the DEBUG_LOG macro (DebugLog.h) instead of a text message. The command is the 16-bit id of the format string
+followed by the raw argument bytes, so a message with one argument is 6 bytes on the link and nothing is built on the heap.
+The host expands it with the table generated by tools/debug_log_table.py.
+
+commandTelemetry():
+Sends the Telemetry counters as a fixed size record of little endian values in the order of the struct fields.
+The record is sent every TELEMETRY_FRAME_INTERVAL frames. Nothing is allocated and the record is 26 bytes on the link.
+The send gauges tell where the link is the limit: many missed send slots with no drain bytes means the UART keeps up
+only just, drain bytes mean the baud rate is too low for the prescaler and pixel format. The longest drain is the time the
+line blanking has to cover.
+
+setPaletteMap(offset, mapBytes, length):
+Copies map bytes from COMMAND_SET_PALETTE_MAP. Index 0 is replaced with 1. The host sends the 128 map bytes in four commands,
+one per frame, since host commands are only read between frames.
 */
 
 void commandStartNewFrame(uint8_t pixelFormat) {
+  if (FRAME_HEADER_VERSION >= 2) {
+    commandFrameHeader(pixelFormat);
+    return;
+  }
+
   // Send the new command marker (0x00)
   waitForPreviousUartByteToBeSent();
   UDR0 = 0x00;
 
-  // Send the command length (4 bytes)
+  // Send the command length (7 bytes)
   waitForPreviousUartByteToBeSent();
-  UDR0 = 4;
+  UDR0 = 7;
 
   // Calculate the checksum for error detection
   uint8_t checksum = 0;
   checksum = sendNextCommandByte(checksum, COMMAND_NEW_FRAME);
-  checksum = sendNextCommandByte(checksum, lineLength & 0xFF); // Lower 8 bits of image width
-  checksum = sendNextCommandByte(checksum, lineCount & 0xFF); // Lower 8 bits of image height
+  checksum = sendNextCommandByte(checksum, roiWidth & 0xFF); // Lower 8 bits of image width
+  checksum = sendNextCommandByte(checksum, roiHeight & 0xFF); // Lower 8 bits of image height
   checksum = sendNextCommandByte(checksum,
-                                 ((lineLength >> 8) & 0x03) // Higher 2 bits of image width
-                                 | ((lineCount >> 6) & 0x0C) // Higher 2 bits of image height
+                                 ((roiWidth >> 8) & 0x03) // Higher 2 bits of image width
+                                 | ((roiHeight >> 6) & 0x0C) // Higher 2 bits of image height
                                  | ((pixelFormat << 4) & 0xF0));
+  checksum = sendNextCommandByte(checksum, roiX & 0xFF); // Lower 8 bits of the origin x
+  checksum = sendNextCommandByte(checksum, roiY & 0xFF); // Lower 8 bits of the origin y
+  checksum = sendNextCommandByte(checksum,
+                                 ((roiX >> 8) & 0x03) // Higher 2 bits of the origin x
+                                 | ((roiY >> 6) & 0x0C)); // Higher 2 bits of the origin y
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+// Send the 21 byte version 2 frame header: sequence number, vsync time, region of interest, pixel format,
+// servo angle, exposure and gain
+void commandFrameHeader(uint8_t pixelFormat) {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (21 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 21;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_FRAME_HEADER);
+  checksum = sendNextCommandWord(checksum, frameCounter); // Sequence number
+  checksum = sendNextCommandWord(checksum, frameVsyncMicros & 0xFFFF); // Vsync time, lower word
+  checksum = sendNextCommandWord(checksum, frameVsyncMicros >> 16); // Vsync time, higher word
+  checksum = sendNextCommandWord(checksum, roiX);
+  checksum = sendNextCommandWord(checksum, roiY);
+  checksum = sendNextCommandWord(checksum, roiWidth);
+  checksum = sendNextCommandWord(checksum, roiHeight);
+  checksum = sendNextCommandByte(checksum, pixelFormat);
+  checksum = sendNextCommandByte(checksum, servoAngle);
+  checksum = sendNextCommandWord(checksum, isExposureControlEnabled ? exposureControl.getExposureLines() : 0);
+  checksum = sendNextCommandWord(checksum, isExposureControlEnabled ? exposureControl.getGain() : 0);
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+void commandTelemetry() {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (23 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 23;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_TELEMETRY);
+  checksum = sendNextCommandWord(checksum, telemetry.framesCaptured);
+  checksum = sendNextCommandWord(checksum, telemetry.framesSkipped);
+  checksum = sendNextCommandWord(checksum, telemetry.servoSteps);
+  checksum = sendNextCommandWord(checksum, telemetry.uartStalls);
+  checksum = sendNextCommandWord(checksum, telemetry.lineOverruns);
+  checksum = sendNextCommandWord(checksum, telemetry.vsyncWaitMillis);
+  checksum = sendNextCommandWord(checksum, telemetry.sendSlotsMissed & 0xFFFF);
+  checksum = sendNextCommandWord(checksum, telemetry.sendSlotsMissed >> 16);
+  checksum = sendNextCommandWord(checksum, telemetry.drainBytes & 0xFFFF);
+  checksum = sendNextCommandWord(checksum, telemetry.drainBytes >> 16);
+  checksum = sendNextCommandWord(checksum, telemetry.longestDrainBytes);
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+// Sent after the drain, so the horizontal blanking has to cover 5 more bytes per line
+void commandLineCrc() {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (2 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 2;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_LINE_CRC);
+  checksum = sendNextCommandByte(checksum, lineCrc);
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+
+  frameCrc = _crc_xmodem_update(frameCrc, lineCrc);
+  frameCrcLines++;
+}
+
+void commandFrameEnd() {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (7 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 7;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_FRAME_END);
+  checksum = sendNextCommandWord(checksum, frameCounter); // Same sequence number as the frame header
+  checksum = sendNextCommandWord(checksum, frameCrcLines);
+  checksum = sendNextCommandWord(checksum, frameCrc);
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+#if PROBES_ENABLED
+void commandProbe(ProbeId probe) {
+  const ProbeStatistics & statistics = probeStatistics[probe];
+  uint32_t meanMicros = statistics.count > 0 ? statistics.sumMicros / statistics.count : 0;
+
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (16 bytes and the histogram)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 16 + PROBE_HISTOGRAM_BINS * 2;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_PROBE);
+  checksum = sendNextCommandByte(checksum, probe);
+  checksum = sendNextCommandWord(checksum, statistics.count);
+  checksum = sendNextCommandWord(checksum, statistics.minMicros & 0xFFFF);
+  checksum = sendNextCommandWord(checksum, statistics.minMicros >> 16);
+  checksum = sendNextCommandWord(checksum, statistics.maxMicros & 0xFFFF);
+  checksum = sendNextCommandWord(checksum, statistics.maxMicros >> 16);
+  checksum = sendNextCommandWord(checksum, meanMicros & 0xFFFF);
+  checksum = sendNextCommandWord(checksum, meanMicros >> 16);
+  for (uint8_t bin = 0; bin < PROBE_HISTOGRAM_BINS; bin++) {
+    checksum = sendNextCommandWord(checksum, statistics.histogram[bin]);
+  }
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+#endif
+
+// Send the camera status and boot timing over UART
+void commandStatus(bool isCameraOk, uint16_t cameraReadyMillis, uint16_t firstFrameMillis) {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (6 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 6;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_STATUS);
+  checksum = sendNextCommandByte(checksum, isCameraOk ? 1 : 0); // 1 if camera.init() succeeded
+  checksum = sendNextCommandByte(checksum, cameraReadyMillis & 0xFF); // Power on to camera ready, lower byte
+  checksum = sendNextCommandByte(checksum, cameraReadyMillis >> 8); // Power on to camera ready, higher byte
+  checksum = sendNextCommandByte(checksum, firstFrameMillis & 0xFF); // Power on to first frame, lower byte (0 = not yet)
+  checksum = sendNextCommandByte(checksum, firstFrameMillis >> 8); // Power on to first frame, higher byte
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+// Number of frames that start before the servo has settled.
+// The move starts at a vsync, so the first frame is always in motion if the angle changes.
+uint8_t getServoSettleFrameCount(uint8_t angleDelta) {
+  if (angleDelta == 0) {
+    return 0;
+  }
+  uint16_t settleMillis = SERVO_SETTLE_MILLIS + angleDelta * SERVO_MILLIS_PER_DEGREE;
+  uint16_t frameMillis = camera.getFrameMillis();
+  // Round up, a partly blurred frame is skipped too
+  return (settleMillis + frameMillis - 1) / frameMillis;
+}
+
+// Marker sent in place of a frame that is skipped because the servo is moving
+void commandServoMotion(uint8_t angle, uint8_t settleFrameCount) {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (3 bytes)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 3;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_SERVO_MOTION);
+  checksum = sendNextCommandByte(checksum, angle); // Servo target angle in degrees
+  checksum = sendNextCommandByte(checksum, settleFrameCount); // Skipped frames left including this one
 
   // Send the checksum byte
   waitForPreviousUartByteToBeSent();
@@ -681,9 +2783,56 @@ void commandDebugPrint(const String debugText) {
 }
 
 
+// Send a tokenized debug message: string id and the raw argument bytes.
+// Use through DEBUG_LOG, which computes the id at compile time.
+template <typename... Arguments>
+void commandDebugLog(uint16_t id, Arguments... arguments) {
+  // Send the new command marker (0x00)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 0x00;
+
+  // Send the command length (command code, id and arguments)
+  waitForPreviousUartByteToBeSent();
+  UDR0 = 3 + DebugLogArgumentsLength<Arguments...>::value;
+
+  // Calculate the checksum for error detection
+  uint8_t checksum = 0;
+  checksum = sendNextCommandByte(checksum, COMMAND_DEBUG_LOG);
+  checksum = sendNextCommandWord(checksum, id);
+  checksum = sendDebugLogArguments(checksum, arguments...);
+
+  // Send the checksum byte
+  waitForPreviousUartByteToBeSent();
+  UDR0 = checksum;
+}
+
+// AVR is little endian, so the bytes are sent in memory order
+template <typename Argument, typename... Arguments>
+uint8_t sendDebugLogArguments(uint8_t checksum, Argument argument, Arguments... arguments) {
+  const uint8_t * argumentBytes = (const uint8_t *)&argument;
+  for (uint8_t i = 0; i < sizeof(Argument); i++) {
+    checksum = sendNextCommandByte(checksum, argumentBytes[i]);
+  }
+  return sendDebugLogArguments(checksum, arguments...);
+}
+
+uint8_t sendDebugLogArguments(uint8_t checksum) {
+  return checksum;
+}
+
+// Send a 16-bit value as two command bytes, little endian
+uint8_t sendNextCommandWord(uint8_t checksum, uint16_t commandWord) {
+  checksum = sendNextCommandByte(checksum, commandWord & 0xFF);
+  return sendNextCommandByte(checksum, commandWord >> 8);
+}
+
 // Send the next command byte over UART
 // Calculates a checksum for error detection
 uint8_t sendNextCommandByte(uint8_t checksum, uint8_t commandByte) {
+  // Only command bytes are counted, pixel bytes of the direct modes wait on every byte anyway
+  if (!isUartReady()) {
+    telemetry.uartStalls++;
+  }
   // Wait until the previous UART byte has been transmitted
   waitForPreviousUartByteToBeSent();
 
@@ -694,11 +2843,275 @@ uint8_t sendNextCommandByte(uint8_t checksum, uint8_t commandByte) {
   return checksum ^ commandByte;
 }
 
+// Read the bytes received from the host and execute complete commands
+void processHostCommands() {
+  while (true) {
+    // Command that was completed during the last frame
+    if (hostCommandState == HOST_COMMAND_COMPLETE) {
+      executeHostCommand();
+      hostCommandState = HOST_COMMAND_WAIT_MARKER;
+    }
+    if (Serial.available() == 0) {
+      break;
+    }
+    parseHostCommandByte(Serial.read());
+  }
+}
+
+// Feed one byte from the host through the parser.
+// A complete command stays in hostCommandBuffer until processHostCommands executes it.
+void parseHostCommandByte(uint8_t receivedByte) {
+  switch (hostCommandState) {
+    default:
+    case HOST_COMMAND_WAIT_MARKER:
+      // Everything outside of a command is ignored
+      if (receivedByte == 0x00) {
+        hostCommandState = HOST_COMMAND_WAIT_LENGTH;
+      }
+      break;
+
+    case HOST_COMMAND_WAIT_LENGTH:
+      if (receivedByte == 0x00) {
+        // Repeated marker, keep waiting for the length
+      } else if (receivedByte > HOST_COMMAND_MAX_LENGTH) {
+        hostCommandState = HOST_COMMAND_WAIT_MARKER;
+      } else {
+        hostCommandLength = receivedByte;
+        hostCommandIndex = 0;
+        hostCommandChecksum = 0;
+        hostCommandState = HOST_COMMAND_WAIT_DATA;
+      }
+      break;
+
+    case HOST_COMMAND_WAIT_DATA:
+      // Store the command byte and update the checksum
+      hostCommandBuffer[hostCommandIndex++] = receivedByte;
+      hostCommandChecksum ^= receivedByte;
+      if (hostCommandIndex == hostCommandLength) {
+        hostCommandState = HOST_COMMAND_WAIT_CHECKSUM;
+      }
+      break;
+
+    case HOST_COMMAND_WAIT_CHECKSUM:
+      // Only execute commands that arrived intact
+      if (receivedByte == hostCommandChecksum) {
+        hostCommandState = HOST_COMMAND_COMPLETE;
+      } else {
+        DEBUG_LOG("Host command 0x%hhx dropped, checksum error", hostCommandBuffer[0]);
+        hostCommandState = HOST_COMMAND_WAIT_MARKER;
+      }
+      break;
+
+    case HOST_COMMAND_COMPLETE:
+      // Not called in this state
+      break;
+  }
+}
+
+// Called with interrupts disabled before the first line of a frame.
+// Bytes that came in during the vertical blanking are parsed first, so the bytes
+// polled from the UART during the frame stay in order behind them.
+void startHostCommandPolling() {
+  while (hostCommandState != HOST_COMMAND_COMPLETE && Serial.available() > 0) {
+    parseHostCommandByte(Serial.read());
+  }
+  // With a complete command waiting the rest stays in the UART until the frame ends
+  isHostCommandPollEnabled = hostCommandState != HOST_COMMAND_COMPLETE;
+}
+
+// Called in the line gaps while interrupts are disabled. The Serial interrupt can't
+// empty the UART then, and a third byte would overwrite the two it holds.
+void pollHostCommandBytes() {
+  while (isHostCommandPollEnabled && (UCSR0A & (1 << RXC0))) {
+    parseHostCommandByte(UDR0);
+    isHostCommandPollEnabled = hostCommandState != HOST_COMMAND_COMPLETE;
+  }
+}
+
+// Execute the command in hostCommandBuffer
+void executeHostCommand() {
+  switch (hostCommandBuffer[0]) {
+    case COMMAND_SET_ROI:
+      if (hostCommandLength == 9) {
+        setRegionOfInterest(
+            hostCommandBuffer[1] | (hostCommandBuffer[2] << 8),
+            hostCommandBuffer[3] | (hostCommandBuffer[4] << 8),
+            hostCommandBuffer[5] | (hostCommandBuffer[6] << 8),
+            hostCommandBuffer[7] | (hostCommandBuffer[8] << 8));
+      }
+      break;
+
+    case COMMAND_SET_RESOLUTION:
+      if (hostCommandLength == 3) {
+        setCameraResolution((CameraOV7670::Resolution)(hostCommandBuffer[1] | (hostCommandBuffer[2] << 8)));
+      }
+      break;
+
+    case COMMAND_SET_THRESHOLD:
+      if (hostCommandLength == 3) {
+        analysisThreshold = hostCommandBuffer[1] | (hostCommandBuffer[2] << 8);
+      }
+      break;
+
+    case COMMAND_REQUEST_PIXELS:
+      if (hostCommandLength == 2) {
+        pixelFrameRequestCount = hostCommandBuffer[1];
+      }
+      break;
+
+    case COMMAND_SET_SCAN_SCHEDULE:
+      if (hostCommandLength >= 2) {
+        setScanSchedule(hostCommandBuffer[1], &hostCommandBuffer[2], hostCommandLength - 2);
+      }
+      break;
+
+    case COMMAND_SET_PALETTE_MAP:
+      // The map only exists in the palette mode
+      if (uartPixelFormat == UART_PIXEL_FORMAT_PALETTE4 && hostCommandLength > 2) {
+        setPaletteMap(hostCommandBuffer[1], &hostCommandBuffer[2], hostCommandLength - 2);
+      }
+      break;
+  }
+}
+
+// Switch between a cheap preview (QQVGA) and detail frames (QVGA).
+// Only the changed camera registers are written, there is no reset and no delay(500).
+void setCameraResolution(CameraOV7670::Resolution resolution) {
+  // Raw Bayer is only available in VGA
+  if (camera.getPixelFormat() == CameraOV7670::PIXEL_BAYERRGB) {
+    DEBUG_LOG("Resolution %u not available in raw Bayer", (uint16_t)resolution);
+    return;
+  }
+
+  // The line buffer has room for QVGA lines at most
+  if ((resolution != CameraOV7670::RESOLUTION_QQVGA_160x120 && resolution != CameraOV7670::RESOLUTION_QVGA_320x240)
+      || resolution * 2 > lineBufferLength) {
+    DEBUG_LOG("Resolution %u not available", (uint16_t)resolution);
+    return;
+  }
+
+  // Returns at the beginning of the first frame in the new resolution
+  camera.reconfigure(resolution, camera.getPixelFormat());
+
+  // Resolution enum value is the line length, both resolutions are 4:3
+  lineLength = resolution;
+  lineCount = resolution * 3 / 4;
+
+  // The old region of interest may be outside the new frame
+  setRegionOfInterest(0, 0, 0, 0);
+}
+
+// Store scan steps uploaded by the host starting from step offset.
+// The schedule ends after the last uploaded step, so a long schedule is sent in order in several commands.
+// The offset can be at most the current length, so there are no stale steps before the uploaded ones.
+// No steps at offset 0 restores the default schedule.
+void setScanSchedule(uint8_t offset, const uint8_t * stepBytes, uint8_t length) {
+  uint8_t stepCount = length / sizeof(ScanStep);
+  if (offset + stepCount > SCAN_SCHEDULE_MAX_STEPS || offset > scanScheduleLength || (stepCount == 0 && offset > 0)) {
+    DEBUG_LOG("Scan schedule rejected, %hhu steps at %hhu", stepCount, offset);
+    return;
+  }
+  if (offset + stepCount == 0) {
+    loadDefaultScanSchedule();
+    return;
+  }
+
+  memcpy(&scanSchedule[offset], stepBytes, stepCount * sizeof(ScanStep));
+  scanScheduleLength = offset + stepCount;
+  // Start from the beginning of the new schedule
+  scanStepIndex = 0;
+  scanStepFramesLeft = 0;
+}
+
+// Store a part of the RGB332 to palette index map uploaded by the host
+void setPaletteMap(uint8_t offset, const uint8_t * mapBytes, uint8_t length) {
+  for (uint8_t i = 0; i < length && offset + i < PALETTE_MAP_LENGTH; i++) {
+    uint8_t mapByte = mapBytes[i];
+    // Index 0 is reserved, otherwise two index 0 pixels would make a 0 byte
+    if ((mapByte & 0xF0) == 0) mapByte |= 0x10;
+    if ((mapByte & 0x0F) == 0) mapByte |= 0x01;
+    paletteMap[offset + i] = mapByte;
+  }
+}
+
+// Select the part of the frame that is read and sent
+void setRegionOfInterest(uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+  if (width == 0 || height == 0) {
+    // Back to the full frame
+    x = 0;
+    y = 0;
+    width = lineLength;
+    height = lineCount;
+  }
+
+  // Keep the region inside the frame
+  if (x >= lineLength) x = lineLength - 1;
+  if (y >= lineCount) y = lineCount - 1;
+  if (width > lineLength - x) width = lineLength - x;
+  if (height > lineCount - y) height = lineCount - y;
+
+  // Bayer lines and columns come in pairs, an odd origin would swap the colors
+  if (uartPixelFormat == UART_PIXEL_FORMAT_BAYER8) {
+    x &= ~1;
+    y &= ~1;
+  }
+
+  // Edge map and dither bytes hold up to 8 pixels
+  if (uartPixelFormat == UART_PIXEL_FORMAT_EDGES
+      || uartPixelFormat == UART_PIXEL_FORMAT_DITHER1 || uartPixelFormat == UART_PIXEL_FORMAT_DITHER2) {
+    x &= ~7;
+    width = width > 7 ? width & ~7 : 8;
+  }
+
+  // Block Truncation Coding works on whole 4x4 blocks
+  if (uartPixelFormat == UART_PIXEL_FORMAT_BTC) {
+    x &= ~3;
+    y &= ~3;
+    width = width > 3 ? width & ~3 : 4;
+    height = height > 3 ? height & ~3 : 4;
+  }
+
+  // U and V are shared by two pixels, palette bytes hold two pixels
+  if (uartPixelFormat == UART_PIXEL_FORMAT_YUV420 || uartPixelFormat == UART_PIXEL_FORMAT_PALETTE4) {
+    x &= ~1;
+    width = width > 1 ? width & ~1 : 2;
+  }
+
+  roiX = x;
+  roiY = y;
+  roiWidth = width;
+  roiHeight = height;
+
+  setClockPreScalerForRegionOfInterest();
+}
+
+// Runs the camera as fast as the link allows for the width of the region of interest.
+// The line time is proportional to pre-scaler + 1 and the bytes to send per line to the width,
+// so a region half as wide gets about twice the frame rate, down to minClockPreScaler.
+// The clock changes in the blanking before the next frame.
+void setClockPreScalerForRegionOfInterest() {
+  uint16_t clockDivider = ((uint16_t)(fullLineClockPreScaler + 1) * roiWidth + lineLength - 1) / lineLength;
+  uint8_t preScaler = clockDivider > 1 ? clockDivider - 1 : 0;
+  if (preScaler < minClockPreScaler) {
+    preScaler = minClockPreScaler;
+  }
+  camera.setInternalClockPreScaler(preScaler);
+}
+
+
 // Wait until the previous UART byte has been successfully transmitted
 void waitForPreviousUartByteToBeSent() {
   while (!isUartReady()); // Wait for the byte to transmit
 }
 
+// Add a sent pixel byte to the CRC-8 of the line (UART_LINE_CRC).
+// Table lookup instead of the bit loop of _crc8_ccitt_update, which takes too long for a send slot
+void updateLineCrc(uint8_t byte) {
+  if (UART_LINE_CRC) {
+    lineCrc = pgm_read_byte(&crc8Table[lineCrc ^ byte]);
+  }
+}
+
 // Check if the UART (USART Data Register Empty) is ready for transmission
 bool isUartReady() {
   // The UDRE0 bit in UCSR0A indicates whether the transmit buffer is empty
@@ -0,0 +1,154 @@
+//
+// Timer1 shared by the servo pulse and periodic software ticks.
+//
+
+#include "Timer1Scheduler.h"
+#include "avr/io.h"
+#include "avr/interrupt.h"
+
+
+
+volatile uint32_t Timer1Scheduler::periodCount = 0;
+uint8_t Timer1Scheduler::tickCount = 0;
+uint16_t Timer1Scheduler::tickPeriods[TIMER1_SCHEDULER_MAX_TICKS];
+volatile uint16_t Timer1Scheduler::tickCounters[TIMER1_SCHEDULER_MAX_TICKS];
+volatile bool Timer1Scheduler::isTickPending[TIMER1_SCHEDULER_MAX_TICKS];
+
+
+
+void Timer1Scheduler::begin() {
+  cli();
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+
+  ICR1 = PERIOD_TICKS - 1;
+  // Tick interrupt after the longest servo pulse
+  OCR1A = COMPARE_TICKS;
+  setServoPulseMicros((TIMER1_SCHEDULER_SERVO_MIN_MICROS + TIMER1_SCHEDULER_SERVO_MAX_MICROS) / 2);
+
+  pinMode(10, OUTPUT);
+  // Fast PWM mode 14, clear OC1B on compare match, set at BOTTOM
+  TCCR1A = _BV(COM1B1) | _BV(WGM11);
+  TCCR1B = _BV(WGM13) | _BV(WGM12) | _BV(CS11);
+  TIMSK1 = _BV(OCIE1A);
+  sei();
+}
+
+
+void Timer1Scheduler::setServoAngle(uint8_t angle) {
+  if (angle > 180) angle = 180;
+  setServoPulseMicros(TIMER1_SCHEDULER_SERVO_MIN_MICROS
+      + (uint32_t)angle * (TIMER1_SCHEDULER_SERVO_MAX_MICROS - TIMER1_SCHEDULER_SERVO_MIN_MICROS) / 180);
+}
+
+
+// OCR1B is double buffered in fast PWM mode.
+// The new pulse width starts with the next period.
+void Timer1Scheduler::setServoPulseMicros(uint16_t pulseMicros) {
+  uint8_t oldSREG = SREG;
+  cli();
+  OCR1B = pulseMicros * TICKS_PER_MICRO;
+  SREG = oldSREG;
+}
+
+
+
+// Returns the tick id for isTickDue. Period is rounded down to whole 20ms periods.
+uint8_t Timer1Scheduler::addTick(uint16_t periodMillis) {
+  uint8_t tick = tickCount < TIMER1_SCHEDULER_MAX_TICKS ? tickCount++ : TIMER1_SCHEDULER_MAX_TICKS - 1;
+  uint16_t periods = periodMillis / PERIOD_MILLIS;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  tickPeriods[tick] = periods > 0 ? periods : 1;
+  tickCounters[tick] = 0;
+  isTickPending[tick] = false;
+  SREG = oldSREG;
+  return tick;
+}
+
+
+// True once for every elapsed tick period. Ticks that are not taken in time are merged.
+bool Timer1Scheduler::isTickDue(uint8_t tick) {
+  if (!isTickPending[tick]) {
+    return false;
+  }
+  isTickPending[tick] = false;
+  return true;
+}
+
+
+// Time in 1/TICKS_PER_MICRO us steps, counted from compare match A.
+// With interrupts disabled the pending compare match is counted here and its
+// flag is cleared, since the interrupt can't do it. Further compare matches
+// between two calls are merged into the pending one. The time never goes
+// backwards, but a section timed with interrupts disabled comes out short by
+// one period for every merged compare match.
+uint32_t Timer1Scheduler::getTicks() {
+  uint8_t oldSREG = SREG;
+  cli();
+  bool isComparePending = TIFR1 & _BV(OCF1A);
+  uint16_t count = TCNT1;
+  // Compare match between the reads, count may be from before it
+  if ((bool)(TIFR1 & _BV(OCF1A)) != isComparePending) {
+    isComparePending = true;
+    count = TCNT1;
+  }
+  if (isComparePending && !(oldSREG & _BV(SREG_I))) {
+    countMissedPeriod();
+    isComparePending = false;
+  }
+  uint32_t periods = periodCount;
+  // Compare match that the interrupt has not counted yet
+  if (isComparePending) {
+    periods++;
+  }
+  SREG = oldSREG;
+
+  uint16_t sinceCompare = count >= COMPARE_TICKS ? count - COMPARE_TICKS : count + PERIOD_TICKS - COMPARE_TICKS;
+  return periods * PERIOD_TICKS + sinceCompare;
+}
+
+
+// Timer1 count for getTicksSince. Cheaper than getTicks and needs no
+// compare match handling, for sections in the line gaps.
+uint16_t Timer1Scheduler::getCount() {
+  return TCNT1;
+}
+
+
+// Ticks since getCount returned count, for sections shorter than PERIOD_MILLIS.
+uint16_t Timer1Scheduler::getTicksSince(uint16_t count) {
+  uint16_t now = TCNT1;
+  return now >= count ? now - count : now + PERIOD_TICKS - count;
+}
+
+
+// Counts a compare match that came while interrupts are disabled.
+// Call with interrupts disabled at least once per PERIOD_MILLIS to keep the
+// ticks going during a long capture.
+void Timer1Scheduler::countMissedPeriod() {
+  if (TIFR1 & _BV(OCF1A)) {
+    // Writing a one clears the flag, the interrupt won't come for this match
+    TIFR1 = _BV(OCF1A);
+    countPeriod();
+  }
+}
+
+
+void Timer1Scheduler::countPeriod() {
+  periodCount++;
+  for (uint8_t i = 0; i < tickCount; i++) {
+    if (++tickCounters[i] >= tickPeriods[i]) {
+      tickCounters[i] = 0;
+      isTickPending[i] = true;
+    }
+  }
+}
+
+
+
+ISR(TIMER1_COMPA_vect) {
+  Timer1Scheduler::countPeriod();
+}
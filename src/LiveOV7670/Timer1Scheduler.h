@@ -0,0 +1,66 @@
+//
+// Timer1 shared by the servo pulse and periodic software ticks.
+//
+
+#ifndef _TIMER1_SCHEDULER_h_
+#define _TIMER1_SCHEDULER_h_
+
+#include "Arduino.h"
+
+
+#ifndef TIMER1_SCHEDULER_MAX_TICKS
+#define TIMER1_SCHEDULER_MAX_TICKS 4
+#endif
+
+// SG90 pulse range, same as the PWMServo defaults
+#ifndef TIMER1_SCHEDULER_SERVO_MIN_MICROS
+#define TIMER1_SCHEDULER_SERVO_MIN_MICROS 544
+#endif
+#ifndef TIMER1_SCHEDULER_SERVO_MAX_MICROS
+#define TIMER1_SCHEDULER_SERVO_MAX_MICROS 2400
+#endif
+
+
+
+// Timer1 runs in fast PWM mode 14 with a 20ms period (TOP = ICR1).
+// The servo pulse is generated by hardware on OC1B (pin 10), so it has
+// no jitter even when interrupts are disabled during capture.
+// Compare match A interrupt comes once per period after the longest pulse
+// has ended and counts the software ticks.
+// Ticks are polled with isTickDue from loop(). Periods during which
+// interrupts are disabled are only counted by countMissedPeriod and getTicks.
+// Timer0 is not touched, so millis() keeps working.
+class Timer1Scheduler {
+
+public:
+  static const uint16_t PERIOD_MILLIS = 20;
+  // Prescaler 8
+  static const uint8_t TICKS_PER_MICRO = F_CPU / 8000000UL;
+  static const uint16_t PERIOD_TICKS = PERIOD_MILLIS * 1000U * TICKS_PER_MICRO;
+  // Tick interrupt after the longest servo pulse
+  static const uint16_t COMPARE_TICKS = (TIMER1_SCHEDULER_SERVO_MAX_MICROS + 100) * TICKS_PER_MICRO;
+
+  static void begin();
+  static void setServoAngle(uint8_t angle);
+  static void setServoPulseMicros(uint16_t pulseMicros);
+
+  static uint8_t addTick(uint16_t periodMillis);
+  static bool isTickDue(uint8_t tick);
+  static uint32_t getTicks();
+  static uint16_t getCount();
+  static uint16_t getTicksSince(uint16_t count);
+  static void countMissedPeriod();
+
+  static void countPeriod();
+
+private:
+  static volatile uint32_t periodCount;
+  static uint8_t tickCount;
+  static uint16_t tickPeriods[TIMER1_SCHEDULER_MAX_TICKS];
+  static volatile uint16_t tickCounters[TIMER1_SCHEDULER_MAX_TICKS];
+  static volatile bool isTickPending[TIMER1_SCHEDULER_MAX_TICKS];
+};
+
+
+
+#endif // _TIMER1_SCHEDULER_h_
@@ -5,8 +5,10 @@
 bool CameraOV7670::init() {
   registers.init();
   initIO();
-  delay(10); // give camera some time to run before starting setup
-  return setUpCamera();
+  // Camera answers on SCCB once it is running on the new clock
+  return registers.waitForCamera(OV7670_READY_TIMEOUT_MS)
+         && setUpCamera()
+         && waitForFirstVsync();
 }
 
 
@@ -18,38 +20,29 @@ void CameraOV7670::initIO() {
 }
 
 
+// Camera is ready when the first frame after setup starts.
+// The timeout follows the frame time, a prescaler of 32 makes a frame over 3 seconds long.
+bool CameraOV7670::waitForFirstVsync() {
+  uint32_t timeoutMs = 2UL * getFrameMillis() + OV7670_VSYNC_TIMEOUT_MARGIN_MS;
+  unsigned long start = millis();
+  while (OV7670_VSYNC) {
+    if (millis() - start >= timeoutMs) return false;
+  }
+  while (!OV7670_VSYNC) {
+    if (millis() - start >= timeoutMs) return false;
+  }
+  return true;
+}
+
+
 bool CameraOV7670::setUpCamera() {
   if (registers.resetSettings()) {
-    registers.setRegisters(CameraOV7670Registers::regsDefault);
-
-    switch (pixelFormat) {
-      default:
-      case PIXEL_RGB565:
-        registers.setRegisters(CameraOV7670Registers::regsRGB565);
-        break;
-      case PIXEL_BAYERRGB:
-        registers.setRegisters(CameraOV7670Registers::regsBayerRGB);
-        break;
-      case PIXEL_YUV422:
-        registers.setRegisters(CameraOV7670Registers::regsYUV422);
-        break;
-    }
-
-    switch (resolution) {
-      case RESOLUTION_VGA_640x480:
-        registers.setRegisters(CameraOV7670Registers::regsVGA);
-        verticalPadding = CameraOV7670Registers::VGA_VERTICAL_PADDING;
-        break;
-      case RESOLUTION_QVGA_320x240:
-        registers.setRegisters(CameraOV7670Registers::regsQVGA);
-        verticalPadding = CameraOV7670Registers::QVGA_VERTICAL_PADDING;
-        break;
-      default:
-      case RESOLUTION_QQVGA_160x120:
-        registers.setRegisters(CameraOV7670Registers::regsQQVGA);
-        verticalPadding = CameraOV7670Registers::QQVGA_VERTICAL_PADDING;
-        break;
-    }
+    // Folded versions of regsDefault + pixel format + resolution tables.
+    // Every register is written only once.
+    registers.setRegisters(CameraOV7670Registers::regsFoldedCommon);
+    registers.setRegisters(getPixelFormatRegisters(pixelFormat));
+    registers.setRegisters(getResolutionRegisters(resolution));
+    verticalPadding = getVerticalPadding(resolution);
 
     registers.setDisablePixelClockDuringBlankLines();
     registers.setDisableHREFDuringBlankLines();
@@ -63,6 +56,72 @@ bool CameraOV7670::setUpCamera() {
 }
 
 
+// Switches resolution and pixel format without resetting the camera.
+// Only the registers that differ between the old and the new mode are written.
+// Returns at the beginning of the first frame with the new settings.
+void CameraOV7670::reconfigure(Resolution newResolution, PixelFormat newFormat) {
+  // Change the registers during vertical blanking
+  waitForVsync();
+  registers.setRegisterChanges(getPixelFormatRegisters(pixelFormat), getPixelFormatRegisters(newFormat));
+  registers.setRegisterChanges(getResolutionRegisters(resolution), getResolutionRegisters(newResolution));
+
+  // The frame after this vsync may still be in the old format. Skip it.
+  while (OV7670_VSYNC);
+  waitForVsync();
+
+  // Capture loop parameters must not be seen half updated
+#ifdef SREG
+  uint8_t oldSREG = SREG;
+  cli();
+#endif
+  resolution = newResolution;
+  pixelFormat = newFormat;
+  verticalPadding = getVerticalPadding(newResolution);
+#ifdef SREG
+  SREG = oldSREG;
+#endif
+}
+
+
+const RegisterData * CameraOV7670::getPixelFormatRegisters(PixelFormat format) {
+  switch (format) {
+    default:
+    case PIXEL_RGB565:
+      return CameraOV7670Registers::regsFoldedRGB565;
+    case PIXEL_BAYERRGB:
+      return CameraOV7670Registers::regsFoldedBayerRGB;
+    case PIXEL_YUV422:
+      return CameraOV7670Registers::regsFoldedYUV422;
+  }
+}
+
+
+const RegisterData * CameraOV7670::getResolutionRegisters(Resolution resolution) {
+  switch (resolution) {
+    case RESOLUTION_VGA_640x480:
+      return CameraOV7670Registers::regsFoldedVGA;
+    case RESOLUTION_QVGA_320x240:
+      return CameraOV7670Registers::regsFoldedQVGA;
+    default:
+    case RESOLUTION_QQVGA_160x120:
+      return CameraOV7670Registers::regsFoldedQQVGA;
+  }
+}
+
+
+uint8_t CameraOV7670::getVerticalPadding(Resolution resolution) {
+  switch (resolution) {
+    case RESOLUTION_VGA_640x480:
+      return CameraOV7670Registers::VGA_VERTICAL_PADDING;
+    case RESOLUTION_QVGA_320x240:
+      return CameraOV7670Registers::QVGA_VERTICAL_PADDING;
+    default:
+    case RESOLUTION_QQVGA_160x120:
+      return CameraOV7670Registers::QQVGA_VERTICAL_PADDING;
+  }
+}
+
+
 bool CameraOV7670::setRegister(uint8_t addr, uint8_t val) {
   registers.setRegister(addr, val);
 }
@@ -79,6 +138,27 @@ void CameraOV7670::setRegisterBitsAND(uint8_t addr, uint8_t bits) {
   registers.setRegisterBitsAND(addr, bits);
 }
 
+// When enabled the setters (setBrightness, setContrast...) don't block on Wire.
+// The writes are queued and done by writeQueuedRegisters.
+void CameraOV7670::setDeferRegisterWrites(bool defer) {
+  registers.setDeferRegisterWrites(defer);
+}
+
+// Call right after waitForVsync with interrupts enabled. Writes a limited number
+// of queued registers so that it is done before the first line of the frame.
+void CameraOV7670::writeQueuedRegisters() {
+  registers.writeQueuedRegisters(OV7670_QUEUED_REGISTER_WRITES_PER_FRAME);
+}
+
+// Frame time follows the clock. With deferred writes the new clock starts
+// with the next writeQueuedRegisters.
+void CameraOV7670::setInternalClockPreScaler(uint8_t preScaler) {
+  if (preScaler != internalClockPreScaler) {
+    internalClockPreScaler = preScaler;
+    registers.setInternalClockPreScaler(preScaler);
+  }
+}
+
 void CameraOV7670::setManualContrastCenter(uint8_t contrastCenter) {
   registers.setManualContrastCenter(contrastCenter);
 }
@@ -103,9 +183,27 @@ void CameraOV7670::showColorBars(bool transparent) {
 }
 
 void CameraOV7670::ignoreVerticalPadding() {
-  for (uint8_t i = 0; i < verticalPadding; i++) {
+  ignoreLines(verticalPadding);
+}
+
+// Raw Bayer has one byte per pixel, other formats two.
+uint16_t CameraOV7670::getLineByteCount() {
+  return pixelFormat == PIXEL_BAYERRGB ? resolution : resolution * 2;
+}
+
+// A frame is 510 rows of 784 pixels, two clocks per pixel, in every resolution.
+uint16_t CameraOV7670::getFrameMillis() {
+  static const uint8_t pllMultipliers[] = {1, 4, 6, 8};
+  uint32_t frameClocks = 510UL * 784 * 2 * (internalClockPreScaler + 1);
+  return frameClocks / ((uint32_t)OV7670_XCLK_KHZ * pllMultipliers[pllMultiplier]);
+}
+
+// Counts the pixel clocks of whole lines without reading them.
+void CameraOV7670::ignoreLines(uint16_t lineCount) {
+  uint16_t lineByteCount = getLineByteCount();
+  for (uint16_t i = 0; i < lineCount; i++) {
     ignoreHorizontalPaddingLeft();
-    for (uint16_t x = 0; x < resolution * 2; x++) {
+    for (uint16_t x = 0; x < lineByteCount; x++) {
       waitForPixelClockRisingEdge();
     }
     ignoreHorizontalPaddingRight();
@@ -133,6 +133,23 @@
 
 
 
+// Added to the frame time (getFrameMillis) for the first frame to start after setup.
+// The wait is for up to one frame in the old settings and one in the new ones.
+#ifndef OV7670_VSYNC_TIMEOUT_MARGIN_MS
+#define OV7670_VSYNC_TIMEOUT_MARGIN_MS 500
+#endif
+
+// Clock from OV7670_INIT_CLOCK_OUT. Only used for timing estimates.
+#ifndef OV7670_XCLK_KHZ
+#define OV7670_XCLK_KHZ 8000
+#endif
+
+// Register writes done right after vsync. Each takes about 80us at 400kHz.
+#ifndef OV7670_QUEUED_REGISTER_WRITES_PER_FRAME
+#define OV7670_QUEUED_REGISTER_WRITES_PER_FRAME 8
+#endif
+
+
 class CameraOV7670 {
 
 public:
@@ -160,7 +177,7 @@ public:
 protected:
     static const uint8_t i2cAddress = 0x21;
 
-    const Resolution resolution;
+    Resolution resolution;
     PixelFormat pixelFormat;
     uint8_t internalClockPreScaler;
     PLLMultiplier pllMultiplier;
@@ -182,10 +199,13 @@ public:
         registers(i2cAddress) {};
 
     bool init();
+    void reconfigure(Resolution resolution, PixelFormat format);
     bool setRegister(uint8_t addr, uint8_t val);
     uint8_t readRegister(uint8_t addr);
     void setRegisterBitsOR(uint8_t addr, uint8_t bits);
     void setRegisterBitsAND(uint8_t addr, uint8_t bits);
+    void setDeferRegisterWrites(bool defer);
+    void writeQueuedRegisters();
     void setManualContrastCenter(uint8_t center);
     void setContrast(uint8_t contrast);
     void setBrightness(uint8_t birghtness);
@@ -193,6 +213,8 @@ public:
     void showColorBars(bool transparent);
 
     inline void waitForVsync(void) __attribute__((always_inline));
+    inline void waitForNextVsync(void) __attribute__((always_inline));
+    inline bool isVsyncHigh(void) __attribute__((always_inline));
     inline void waitForPixelClockRisingEdge(void) __attribute__((always_inline));
     inline void waitForPixelClockLow(void) __attribute__((always_inline));
     inline void waitForPixelClockHigh(void) __attribute__((always_inline));
@@ -201,12 +223,22 @@ public:
     inline void readPixelByte(uint8_t & byte) __attribute__((always_inline));
 
     virtual void ignoreVerticalPadding();
+    void ignoreLines(uint16_t lineCount);
+    uint16_t getLineByteCount();
+    PixelFormat getPixelFormat() { return pixelFormat; };
+    uint8_t getInternalClockPreScaler() { return internalClockPreScaler; };
+    void setInternalClockPreScaler(uint8_t preScaler);
+    uint16_t getFrameMillis();
 
 protected:
     virtual bool setUpCamera();
 
 private:
     void initIO();
+    bool waitForFirstVsync();
+    static const RegisterData * getPixelFormatRegisters(PixelFormat format);
+    static const RegisterData * getResolutionRegisters(Resolution resolution);
+    static uint8_t getVerticalPadding(Resolution resolution);
 
 };
 
@@ -216,6 +248,17 @@ void CameraOV7670::waitForVsync() {
   while(!OV7670_VSYNC);
 }
 
+// Returns at the start of the next frame even if vsync is still high.
+void CameraOV7670::waitForNextVsync() {
+  while(OV7670_VSYNC);
+  while(!OV7670_VSYNC);
+}
+
+// Vsync is high for a few lines at the start of every frame.
+bool CameraOV7670::isVsyncHigh() {
+  return OV7670_VSYNC;
+}
+
 void CameraOV7670::waitForPixelClockRisingEdge() {
   waitForPixelClockLow();
   waitForPixelClockHigh();
@@ -234,12 +277,14 @@ void CameraOV7670::ignoreHorizontalPaddingLeft() {
   waitForPixelClockRisingEdge();
 }
 
-// Three bytes at the end
+// Three bytes at the end (one byte in raw Bayer where a pixel is a single byte)
 void CameraOV7670::ignoreHorizontalPaddingRight() {
   volatile uint16_t pixelTime = 0;
 
-  waitForPixelClockRisingEdge();
-  waitForPixelClockRisingEdge();
+  if (pixelFormat != PIXEL_BAYERRGB) {
+    waitForPixelClockRisingEdge();
+    waitForPixelClockRisingEdge();
+  }
 
   // After the last pixel byte of an image line there is a very small pixel clock pulse.
   // To avoid accidentally counting this small pulse we measure the length of the
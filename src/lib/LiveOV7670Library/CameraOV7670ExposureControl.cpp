@@ -0,0 +1,202 @@
+//
+// Exposure and white balance loop running on the Arduino instead of the camera.
+//
+
+#include "CameraOV7670ExposureControl.h"
+#include "CameraOV7670RegisterDefinitions.h"
+
+
+#define GAIN_MIN 16
+#define GAIN_MAX (31 * 16)
+// Channel gain change per frame is limited to 2x
+#define CHANNEL_GAIN_MIN 0x10
+#define CHANNEL_GAIN_MAX 0xFF
+#define BRIGHTNESS_MAX 0x40
+// Exposure change per frame is limited to 4x
+#define EXPOSURE_MAX_STEP 4
+#define LUMA_DEAD_BAND 4
+
+
+
+// Takes over from the camera's own loops starting from whatever they
+// have settled to. Must be called before deferred register writes are enabled.
+void CameraOV7670ExposureControl::begin() {
+  gain = getGainFromRegister(camera.readRegister(REG_GAIN));
+  com1 = camera.readRegister(REG_COM1);
+  exposureLines =
+      ((uint16_t)(camera.readRegister(REG_AECHH) & 0x3F) << 10)
+      | ((uint16_t)camera.readRegister(REG_AECH) << 2)
+      | (com1 & 0x03);
+  com1 &= ~0x03;
+  if (exposureLines == 0) exposureLines = 1;
+  if (exposureLines > OV7670_EXPOSURE_MAX_LINES) exposureLines = OV7670_EXPOSURE_MAX_LINES;
+  redGain = camera.readRegister(REG_RED);
+  blueGain = camera.readRegister(REG_BLUE);
+  brightness = 0;
+
+  camera.setRegisterBitsAND(REG_COM8, ~(COM8_AGC | COM8_AEC | COM8_AWB));
+  camera.setBrightness(brightness);
+  writeExposure();
+
+  resetStatistics();
+  ignoreFrameCount = 1;
+}
+
+
+void CameraOV7670ExposureControl::resetStatistics() {
+  redSum = 0;
+  greenSum = 0;
+  blueSum = 0;
+  lumaSum = 0;
+  sampleCount = 0;
+  isRgbStatistics = false;
+}
+
+
+
+// Call in vertical blanking after the last sample of the frame.
+// New settings take effect on the next frame, so statistics of the frame
+// captured during the change are discarded.
+void CameraOV7670ExposureControl::update() {
+  if (sampleCount == 0) {
+    return;
+  }
+
+  if (ignoreFrameCount > 0) {
+    ignoreFrameCount--;
+  } else {
+    uint16_t exposureBefore = exposureLines;
+    uint16_t gainBefore = gain;
+    updateExposure(getMeanLuma());
+    if (isRgbStatistics) {
+      updateWhiteBalance();
+    }
+    if (exposureLines != exposureBefore || gain != gainBefore) {
+      ignoreFrameCount = 1;
+    }
+  }
+
+  resetStatistics();
+}
+
+
+
+// Sums stay within 32 bits for up to 16k samples per frame.
+uint8_t CameraOV7670ExposureControl::getMeanLuma() {
+  uint32_t luma;
+  if (isRgbStatistics) {
+    // Y = 0.299R + 0.587G + 0.114B scaled from 5/6/5 bits to 8 bits
+    luma = (616UL * redSum + 600UL * greenSum + 232UL * blueSum) / sampleCount >> 8;
+  } else {
+    luma = lumaSum / sampleCount;
+  }
+  return luma > 255 ? 255 : luma;
+}
+
+
+
+void CameraOV7670ExposureControl::updateExposure(uint8_t meanLuma) {
+  if (meanLuma + LUMA_DEAD_BAND >= OV7670_EXPOSURE_TARGET_LUMA
+      && meanLuma <= OV7670_EXPOSURE_TARGET_LUMA + LUMA_DEAD_BAND) {
+    return;
+  }
+
+  // Exposure needed for the target if the scene stays the same.
+  uint32_t total = (uint32_t)exposureLines * gain;
+  uint32_t target = total * OV7670_EXPOSURE_TARGET_LUMA / (meanLuma > 0 ? meanLuma : 1);
+  if (target > total * EXPOSURE_MAX_STEP) target = total * EXPOSURE_MAX_STEP;
+  if (target < total / EXPOSURE_MAX_STEP) target = total / EXPOSURE_MAX_STEP;
+
+  // Longer exposure first since gain adds noise.
+  uint32_t newExposure = target / GAIN_MIN;
+  if (newExposure < 1) newExposure = 1;
+  if (newExposure > OV7670_EXPOSURE_MAX_LINES) newExposure = OV7670_EXPOSURE_MAX_LINES;
+  uint32_t newGain = target / newExposure;
+  if (newGain < GAIN_MIN) newGain = GAIN_MIN;
+  if (newGain > GAIN_MAX) newGain = GAIN_MAX;
+  uint8_t gainRegister = getGainRegister(newGain);
+
+  if (newExposure != exposureLines) {
+    exposureLines = newExposure;
+    writeExposure();
+  }
+  if (getGainFromRegister(gainRegister) != gain) {
+    gain = getGainFromRegister(gainRegister);
+    camera.setRegister(REG_GAIN, gainRegister);
+  }
+
+  // Digital offset is the last resort when the scene is too dark
+  // for the longest exposure and highest gain.
+  uint8_t newBrightness = 0;
+  if (exposureLines == OV7670_EXPOSURE_MAX_LINES && gain == GAIN_MAX && meanLuma < OV7670_EXPOSURE_TARGET_LUMA) {
+    uint8_t step = (OV7670_EXPOSURE_TARGET_LUMA - meanLuma) >> 1;
+    newBrightness = brightness + step > BRIGHTNESS_MAX ? BRIGHTNESS_MAX : brightness + step;
+  }
+  if (newBrightness != brightness) {
+    brightness = newBrightness;
+    camera.setBrightness(brightness);
+  }
+}
+
+
+static uint8_t scaleChannelGain(uint8_t channelGain, uint32_t channelSum, uint32_t referenceSum) {
+  uint32_t difference = channelSum > referenceSum ? channelSum - referenceSum : referenceSum - channelSum;
+  if (channelSum == 0 || difference * 32 <= referenceSum) {
+    return channelGain;
+  }
+  uint32_t scaled = channelGain * referenceSum / channelSum;
+  if (scaled > channelGain * 2UL) scaled = channelGain * 2UL;
+  if (scaled < channelGain / 2) scaled = channelGain / 2;
+  if (scaled < CHANNEL_GAIN_MIN) scaled = CHANNEL_GAIN_MIN;
+  if (scaled > CHANNEL_GAIN_MAX) scaled = CHANNEL_GAIN_MAX;
+  return scaled;
+}
+
+
+// Gray world: the average of the scene is assumed to be gray,
+// so red and blue gains are set to make their means equal to green.
+void CameraOV7670ExposureControl::updateWhiteBalance() {
+  // Green has one bit more than red and blue
+  uint8_t newRedGain = scaleChannelGain(redGain, redSum << 1, greenSum);
+  uint8_t newBlueGain = scaleChannelGain(blueGain, blueSum << 1, greenSum);
+  if (newRedGain != redGain) {
+    redGain = newRedGain;
+    camera.setRegister(REG_RED, redGain);
+  }
+  if (newBlueGain != blueGain) {
+    blueGain = newBlueGain;
+    camera.setRegister(REG_BLUE, blueGain);
+  }
+}
+
+
+
+// Exposure bits 15:10 in AECHH, 9:2 in AECH and 1:0 in COM1
+void CameraOV7670ExposureControl::writeExposure() {
+  camera.setRegister(REG_AECHH, (exposureLines >> 10) & 0x3F);
+  camera.setRegister(REG_AECH, (exposureLines >> 2) & 0xFF);
+  camera.setRegister(REG_COM1, com1 | (exposureLines & 0x03));
+}
+
+
+
+// Each of the bits 7:4 doubles the gain and bits 3:0 add 1/16 of it.
+// Returned in 1/16 steps (16 = 1x).
+uint16_t CameraOV7670ExposureControl::getGainFromRegister(uint8_t gainRegister) {
+  uint16_t value = GAIN_MIN + (gainRegister & 0x0F);
+  for (uint8_t bit = 0x10; bit; bit <<= 1) {
+    if (gainRegister & bit) value <<= 1;
+  }
+  return value;
+}
+
+
+uint8_t CameraOV7670ExposureControl::getGainRegister(uint16_t gain) {
+  uint8_t doublings = 0;
+  while (gain >= GAIN_MIN * 2 && doublings < 4) {
+    gain >>= 1;
+    doublings++;
+  }
+  uint8_t fraction = gain > GAIN_MIN + 0x0F ? 0x0F : gain - GAIN_MIN;
+  return (((1 << doublings) - 1) << 4) | fraction;
+}
@@ -0,0 +1,91 @@
+//
+// Exposure and white balance loop running on the Arduino instead of the camera.
+//
+
+#ifndef _CAMERA_OV7670_EXPOSURE_CONTROL_h_
+#define _CAMERA_OV7670_EXPOSURE_CONTROL_h_
+
+#include "CameraOV7670.h"
+
+
+#ifndef OV7670_EXPOSURE_TARGET_LUMA
+#define OV7670_EXPOSURE_TARGET_LUMA 118
+#endif
+
+// Exposure time is counted in sensor rows.
+#ifndef OV7670_EXPOSURE_MAX_LINES
+#define OV7670_EXPOSURE_MAX_LINES 500
+#endif
+
+
+
+// The camera's own AGC/AEC/AWB step towards the target a little every frame
+// and need many frames to settle after the scene changes.
+// This controller assumes that image brightness is proportional to
+// exposure time * gain and computes the new setting from one frame of
+// statistics. The statistics are collected by the capture code with
+// addRgb565Sample or addLumaSample and update() must be called in
+// vertical blanking with deferred register writes enabled.
+class CameraOV7670ExposureControl {
+
+  CameraOV7670 & camera;
+
+  // Exposure time in rows and gain in 1/16 steps (16 = 1x)
+  uint16_t exposureLines;
+  uint16_t gain;
+  uint8_t redGain;
+  uint8_t blueGain;
+  uint8_t brightness;
+  uint8_t com1;
+
+  uint32_t redSum;
+  uint32_t greenSum;
+  uint32_t blueSum;
+  uint32_t lumaSum;
+  uint16_t sampleCount;
+  bool isRgbStatistics;
+  uint8_t ignoreFrameCount;
+
+public:
+  CameraOV7670ExposureControl(CameraOV7670 & camera) : camera(camera) {};
+
+  void begin();
+  void update();
+  void resetStatistics();
+
+  inline void addRgb565Sample(uint8_t pixelByteH, uint8_t pixelByteL) __attribute__((always_inline));
+  inline void addLumaSample(uint8_t luma) __attribute__((always_inline));
+
+  uint16_t getExposureLines() { return exposureLines; };
+  uint16_t getGain() { return gain; };
+
+private:
+  uint8_t getMeanLuma();
+  void updateExposure(uint8_t meanLuma);
+  void updateWhiteBalance();
+  void writeExposure();
+
+  static uint16_t getGainFromRegister(uint8_t gainRegister);
+  static uint8_t getGainRegister(uint16_t gain);
+};
+
+
+
+void CameraOV7670ExposureControl::addRgb565Sample(uint8_t pixelByteH, uint8_t pixelByteL) {
+  // RRRRRGGG GGGBBBBB
+  redSum += pixelByteH >> 3;
+  greenSum += ((pixelByteH & 0x07) << 3) | (pixelByteL >> 5);
+  blueSum += pixelByteL & 0x1F;
+  sampleCount++;
+  isRgbStatistics = true;
+}
+
+
+void CameraOV7670ExposureControl::addLumaSample(uint8_t luma) {
+  lumaSum += luma;
+  sampleCount++;
+}
+
+
+
+#endif // _CAMERA_OV7670_EXPOSURE_CONTROL_h_
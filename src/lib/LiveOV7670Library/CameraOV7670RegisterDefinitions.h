@@ -26,6 +26,8 @@ struct RegisterData {
 #define COM2_SSLEEP	0x10	/* Soft sleep mode */
 #define REG_PID		0x0a	/* Product ID MSB */
 #define REG_VER		0x0b	/* Product ID LSB */
+#define PID_OV7670	0x76	/* REG_PID value */
+#define VER_OV7670	0x73	/* REG_VER value */
 #define REG_COM3	0x0c	/* Control 3 */
 #define COM3_SWAP	0x40	/* Byte swap */
 #define COM3_SCALEEN	0x08	/* Enable scaling */
@@ -6,23 +6,52 @@
 
 
 
+// Registers that the setters update bit by bit. Only these are kept in RAM,
+// a full shadow of 0x00..0xC9 would take over 10% of the SRAM of an Uno.
+const uint8_t CameraOV7670Registers::shadowRegisters[SHADOW_REGISTER_COUNT] PROGMEM = {
+    REG_COM3,
+    REG_COM6,
+    REG_COM7,
+    REG_COM8,
+    REG_COM10,
+    REG_COM17,
+    MTXS,
+    DBLV,
+};
+
 
 
 CameraOV7670Registers::CameraOV7670Registers(const uint8_t i2cAddress) : i2cAddress(i2cAddress) {
+  invalidateShadowRegisters();
 }
 
 
 
 void CameraOV7670Registers::init() {
   Wire.begin();
+  Wire.setClock(OV7670_SCCB_CLOCK);
 }
 
 
 
 bool CameraOV7670Registers::resetSettings() {
   bool isSuccessful = setRegister(REG_COM7, COM7_RESET);
-  delay(500);
-  return isSuccessful;
+  // Continue as soon as the camera answers again instead of a fixed delay
+  return isSuccessful && waitForCamera(OV7670_READY_TIMEOUT_MS);
+}
+
+
+
+// Polls the product ID until the camera answers. Returns false on timeout.
+bool CameraOV7670Registers::waitForCamera(uint16_t timeoutMs) {
+  unsigned long start = millis();
+  do {
+    delay(1);
+    if (readRegister(REG_PID) == PID_OV7670 && readRegister(REG_VER) == VER_OV7670) {
+      return true;
+    }
+  } while (millis() - start < timeoutMs);
+  return false;
 }
 
 
@@ -37,7 +66,7 @@ void CameraOV7670Registers::setRegisters(const RegisterData *programMemPointer)
     if (regData.addr == 0xFF) {
       break;
     } else {
-      setRegister(regData.addr, regData.val);
+      writeRegister(regData.addr, regData.val);
       programMemPointer++;
     }
   }
@@ -45,35 +74,222 @@ void CameraOV7670Registers::setRegisters(const RegisterData *programMemPointer)
 
 
 
+// Both tables must list the same registers in the same order (like the regsFolded tables).
+// Only the registers that have a different value in the new table are written.
+// A queued write to one of these registers was built on the old value and would undo
+// the new one at the next writeQueuedRegisters, so it is dropped.
+void CameraOV7670Registers::setRegisterChanges(const RegisterData *currentProgramMemPointer, const RegisterData *newProgramMemPointer) {
+  while (true) {
+    RegisterData newRegData = {
+        addr: pgm_read_byte(&(newProgramMemPointer->addr)),
+        val: pgm_read_byte(&(newProgramMemPointer->val))
+    };
+    if (newRegData.addr == 0xFF) {
+      break;
+    } else {
+      if (pgm_read_byte(&(currentProgramMemPointer->addr)) != newRegData.addr
+          || pgm_read_byte(&(currentProgramMemPointer->val)) != newRegData.val) {
+        dropQueuedRegister(newRegData.addr);
+        writeRegister(newRegData.addr, newRegData.val);
+      }
+      currentProgramMemPointer++;
+      newProgramMemPointer++;
+    }
+  }
+}
+
+
+
+// Writes right away unless deferred writes are enabled.
 bool CameraOV7670Registers::setRegister(uint8_t addr, uint8_t val) {
+  if (isDeferRegisterWrites) {
+    return queueRegister(addr, val);
+  } else {
+    return writeRegister(addr, val);
+  }
+}
+
+
+
+bool CameraOV7670Registers::writeRegister(uint8_t addr, uint8_t val) {
   Wire.beginTransmission(i2cAddress);
   Wire.write(addr);
   Wire.write(val);
-  return Wire.endTransmission() == 0;
+  bool isSuccessful = Wire.endTransmission() == 0;
+
+  if (addr == REG_COM7 && (val & COM7_RESET)) {
+    // All registers go back to their defaults
+    invalidateShadowRegisters();
+  } else if (isSuccessful) {
+    setShadowRegister(addr, val);
+  } else {
+    invalidateShadowRegister(addr);
+  }
+  return isSuccessful;
 }
 
 
 
+// Returns 0 if the camera did not answer. Only a value that was really read goes to the shadow.
 uint8_t CameraOV7670Registers::readRegister(uint8_t addr) {
   Wire.beginTransmission(i2cAddress);
   Wire.write(addr);
   Wire.endTransmission();
 
-  Wire.requestFrom(i2cAddress, (uint8_t)1);
-  return Wire.read();
+  if (Wire.requestFrom(i2cAddress, (uint8_t)1) == 1) {
+    uint8_t val = Wire.read();
+    setShadowRegister(addr, val);
+    return val;
+  } else {
+    invalidateShadowRegister(addr);
+    return 0;
+  }
 }
 
 void CameraOV7670Registers::setRegisterBitsOR(uint8_t addr, uint8_t bits) {
-  uint8_t val = readRegister(addr);
+  uint8_t val = readCachedRegister(addr);
   setRegister(addr, val | bits);
 }
 
 void CameraOV7670Registers::setRegisterBitsAND(uint8_t addr, uint8_t bits) {
-  uint8_t val = readRegister(addr);
+  uint8_t val = readCachedRegister(addr);
   setRegister(addr, val & bits);
 }
 
 
+
+// While enabled setRegister (and all setters using it) only queue the write.
+// The queue is written out with writeQueuedRegisters during vertical blanking.
+// setRegisters and setRegisterChanges always write immediately.
+void CameraOV7670Registers::setDeferRegisterWrites(bool defer) {
+  isDeferRegisterWrites = defer;
+}
+
+
+
+// Returns false if the queue is full.
+// A write to a register that is already in the queue replaces the queued value.
+bool CameraOV7670Registers::queueRegister(uint8_t addr, uint8_t val) {
+  // Setters may also be called from interrupt code
+#ifdef SREG
+  uint8_t oldSREG = SREG;
+  cli();
+#endif
+  bool isQueued = false;
+  for (uint8_t i = 0; i < writeQueueLength; i++) {
+    RegisterData & queued = writeQueue[(writeQueueStart + i) % OV7670_REGISTER_QUEUE_LENGTH];
+    if (queued.addr == addr) {
+      queued.val = val;
+      isQueued = true;
+      break;
+    }
+  }
+
+  if (!isQueued && writeQueueLength < OV7670_REGISTER_QUEUE_LENGTH) {
+    RegisterData & queued = writeQueue[(writeQueueStart + writeQueueLength) % OV7670_REGISTER_QUEUE_LENGTH];
+    queued.addr = addr;
+    queued.val = val;
+    writeQueueLength++;
+    isQueued = true;
+  }
+
+  if (isQueued) {
+    // Following bit updates build on the queued value
+    setShadowRegister(addr, val);
+  }
+#ifdef SREG
+  SREG = oldSREG;
+#endif
+  return isQueued;
+}
+
+
+
+// Removes the queued write to the register, if there is one. The other writes keep their order.
+void CameraOV7670Registers::dropQueuedRegister(uint8_t addr) {
+#ifdef SREG
+  uint8_t oldSREG = SREG;
+  cli();
+#endif
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < writeQueueLength; i++) {
+    RegisterData & queued = writeQueue[(writeQueueStart + i) % OV7670_REGISTER_QUEUE_LENGTH];
+    if (queued.addr != addr) {
+      writeQueue[(writeQueueStart + count) % OV7670_REGISTER_QUEUE_LENGTH] = queued;
+      count++;
+    }
+  }
+  writeQueueLength = count;
+#ifdef SREG
+  SREG = oldSREG;
+#endif
+}
+
+
+
+// Writes at most maxCount queued registers. Returns the number of registers written.
+// Wire waits for the TWI interrupt, so with interrupts disabled nothing is written
+// and the queue is kept for the next call.
+uint8_t CameraOV7670Registers::writeQueuedRegisters(uint8_t maxCount) {
+#ifdef SREG
+  if (!(SREG & (1 << SREG_I))) {
+    return 0;
+  }
+#endif
+  uint8_t count = 0;
+  while (writeQueueLength > 0 && count < maxCount) {
+    RegisterData & queued = writeQueue[writeQueueStart];
+    writeRegister(queued.addr, queued.val);
+    writeQueueStart = (writeQueueStart + 1) % OV7670_REGISTER_QUEUE_LENGTH;
+    writeQueueLength--;
+    count++;
+  }
+  return count;
+}
+
+
+
+// Value from the shadow if it is known. Falls back to reading it from the camera.
+uint8_t CameraOV7670Registers::readCachedRegister(uint8_t addr) {
+  uint8_t index = getShadowIndex(addr);
+  if (index < SHADOW_REGISTER_COUNT && (shadowValid & (1 << index))) {
+    return shadowValues[index];
+  } else {
+    return readRegister(addr);
+  }
+}
+
+void CameraOV7670Registers::setShadowRegister(uint8_t addr, uint8_t val) {
+  uint8_t index = getShadowIndex(addr);
+  if (index < SHADOW_REGISTER_COUNT) {
+    shadowValues[index] = val;
+    shadowValid |= (1 << index);
+  }
+}
+
+void CameraOV7670Registers::invalidateShadowRegister(uint8_t addr) {
+  uint8_t index = getShadowIndex(addr);
+  if (index < SHADOW_REGISTER_COUNT) {
+    shadowValid &= ~(1 << index);
+  }
+}
+
+void CameraOV7670Registers::invalidateShadowRegisters() {
+  shadowValid = 0;
+}
+
+// Index in shadowRegisters or SHADOW_REGISTER_COUNT if the register is not shadowed.
+// Registers that the camera updates itself (gain, exposure, white balance) must never be added.
+uint8_t CameraOV7670Registers::getShadowIndex(uint8_t addr) {
+  for (uint8_t i = 0; i < SHADOW_REGISTER_COUNT; i++) {
+    if (pgm_read_byte(&shadowRegisters[i]) == addr) {
+      return i;
+    }
+  }
+  return SHADOW_REGISTER_COUNT;
+}
+
+
 void CameraOV7670Registers::setDisablePixelClockDuringBlankLines() {
   setRegisterBitsOR(REG_COM10, COM10_PCLK_HB);
 }
@@ -94,7 +310,7 @@ void CameraOV7670Registers::setInternalClockPreScaler(int preScaler) {
 
 void CameraOV7670Registers::setPLLMultiplier(uint8_t multiplier) {
   uint8_t mask = 0b11000000;
-  uint8_t currentValue = readRegister(DBLV);
+  uint8_t currentValue = readCachedRegister(DBLV);
   setRegister(DBLV, (currentValue & ~mask) | (multiplier << 6));
 }
 
@@ -7,6 +7,20 @@
 #include "CameraOV7670RegisterDefinitions.h"
 
 
+// SCCB is specified up to 400kHz. Wire defaults to 100kHz.
+#ifndef OV7670_SCCB_CLOCK
+#define OV7670_SCCB_CLOCK 400000
+#endif
+
+// Upper limit for the camera to answer on SCCB after power up or reset.
+#ifndef OV7670_READY_TIMEOUT_MS
+#define OV7670_READY_TIMEOUT_MS 500
+#endif
+
+// Register writes that can wait for the next vertical blanking.
+#ifndef OV7670_REGISTER_QUEUE_LENGTH
+#define OV7670_REGISTER_QUEUE_LENGTH 16
+#endif
 
 
 class CameraOV7670Registers {
@@ -15,6 +29,19 @@ class CameraOV7670Registers {
 private:
     uint8_t i2cAddress;
 
+    // Last value written to (or read from) the registers in shadowRegisters.
+    // Bit updates use it instead of reading the register back over SCCB.
+    static const uint8_t SHADOW_REGISTER_COUNT = 8;
+    static const uint8_t shadowRegisters[SHADOW_REGISTER_COUNT];
+    uint8_t shadowValues[SHADOW_REGISTER_COUNT];
+    uint8_t shadowValid = 0; // One bit per shadowRegisters entry
+
+    // Ring buffer of deferred register writes
+    bool isDeferRegisterWrites = false;
+    RegisterData writeQueue[OV7670_REGISTER_QUEUE_LENGTH];
+    uint8_t writeQueueStart = 0;
+    uint8_t writeQueueLength = 0;
+
 public:
     static const RegisterData regsDefault[];
     static const RegisterData regsRGB565[];
@@ -24,6 +51,15 @@ public:
     static const RegisterData regsQVGA[];
     static const RegisterData regsVGA[];
 
+    // Generated from the tables above by tools/fold_register_tables.py
+    static const RegisterData regsFoldedCommon[];
+    static const RegisterData regsFoldedRGB565[];
+    static const RegisterData regsFoldedBayerRGB[];
+    static const RegisterData regsFoldedYUV422[];
+    static const RegisterData regsFoldedQQVGA[];
+    static const RegisterData regsFoldedQVGA[];
+    static const RegisterData regsFoldedVGA[];
+
     static const uint8_t QQVGA_VERTICAL_PADDING;
     static const uint8_t QVGA_VERTICAL_PADDING;
     static const uint8_t VGA_VERTICAL_PADDING;
@@ -33,11 +69,16 @@ public:
     void init();
 
     bool resetSettings();
+    bool waitForCamera(uint16_t timeoutMs);
     void setRegisters(const RegisterData *registerData);
+    void setRegisterChanges(const RegisterData *currentRegisterData, const RegisterData *newRegisterData);
     bool setRegister(uint8_t addr, uint8_t val);
     uint8_t readRegister(uint8_t addr);
     void setRegisterBitsOR(uint8_t addr, uint8_t bits);
     void setRegisterBitsAND(uint8_t addr, uint8_t bits);
+    void setDeferRegisterWrites(bool defer);
+    bool queueRegister(uint8_t addr, uint8_t val);
+    uint8_t writeQueuedRegisters(uint8_t maxCount);
 
     void setDisablePixelClockDuringBlankLines();
     void setDisableHREFDuringBlankLines();
@@ -50,6 +91,15 @@ public:
     void reversePixelBits();
     void setShowColorBar(bool transparent);
 
+private:
+    bool writeRegister(uint8_t addr, uint8_t val);
+    void dropQueuedRegister(uint8_t addr);
+    uint8_t readCachedRegister(uint8_t addr);
+    void setShadowRegister(uint8_t addr, uint8_t val);
+    void invalidateShadowRegister(uint8_t addr);
+    void invalidateShadowRegisters();
+    static uint8_t getShadowIndex(uint8_t addr);
+
 };
 
 
@@ -0,0 +1,242 @@
+//
+// Generated by tools/fold_register_tables.py from regsDefault, the pixel format
+// tables and the resolution tables. Do not edit, edit those and regenerate.
+//
+// Setting up a camera mode writes regsFoldedCommon, then one pixel format table
+// and then one resolution table. Each register is written once.
+// The layered tables wrote 166 to 178 registers per mode, the folded tables write 154.
+//
+
+#include "CameraOV7670Registers.h"
+
+
+// Same in every pixel format and resolution
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedCommon [] = {
+    {0x3a, 0x04}, // REG_TSLB
+    {0x70, 0x3a},
+    {0x71, 0x35},
+    {0xa2, 0x01},
+    {0x15, 0x00}, // REG_COM10
+    {0x7a, 0x20},
+    {0x7b, 0x10},
+    {0x7c, 0x1e},
+    {0x7d, 0x35},
+    {0x7e, 0x5a},
+    {0x7f, 0x69},
+    {0x80, 0x76},
+    {0x81, 0x80},
+    {0x82, 0x88},
+    {0x83, 0x8f},
+    {0x84, 0x96},
+    {0x85, 0xa3},
+    {0x86, 0xaf},
+    {0x87, 0xc4},
+    {0x88, 0xd7},
+    {0x89, 0xe8},
+    {0x00, 0x00}, // REG_GAIN
+    {0x10, 0x00}, // REG_AECH
+    {0x0d, 0x40}, // REG_COM4
+    {0xa5, 0x05}, // REG_BD50MAX
+    {0xab, 0x07}, // REG_BD60MAX
+    {0x24, 0x95}, // REG_AEW
+    {0x25, 0x33}, // REG_AEB
+    {0x26, 0xe3}, // REG_VPT
+    {0x9f, 0x78}, // REG_HAECC1
+    {0xa0, 0x68}, // REG_HAECC2
+    {0xa1, 0x03},
+    {0xa6, 0xd8}, // REG_HAECC3
+    {0xa7, 0xd8}, // REG_HAECC4
+    {0xa8, 0xf0}, // REG_HAECC5
+    {0xa9, 0x90}, // REG_HAECC6
+    {0xaa, 0x94}, // REG_HAECC7
+    {0x30, 0x00}, // REG_HSYST
+    {0x31, 0x00}, // REG_HSYEN
+    {0x0e, 0x61}, // REG_COM5
+    {0x0f, 0x4b}, // REG_COM6
+    {0x16, 0x02},
+    {0x1e, 0x07}, // REG_MVFP
+    {0x21, 0x02},
+    {0x22, 0x91},
+    {0x29, 0x07},
+    {0x33, 0x0b},
+    {0x35, 0x0b},
+    {0x37, 0x1d},
+    {0x38, 0x71},
+    {0x39, 0x2a},
+    {0x3c, 0x78}, // REG_COM12
+    {0x4d, 0x40},
+    {0x4e, 0x20},
+    {0x69, 0x00}, // REG_GFIX
+    {0x74, 0x10},
+    {0x8d, 0x4f},
+    {0x8e, 0x00},
+    {0x8f, 0x00},
+    {0x90, 0x00},
+    {0x91, 0x00},
+    {0xb0, 0x84},
+    {0xb1, 0x0c},
+    {0xb2, 0x0e},
+    {0xb3, 0x82},
+    {0xb8, 0x0a},
+    {0x43, 0x0a},
+    {0x44, 0xf0},
+    {0x45, 0x34},
+    {0x46, 0x58},
+    {0x47, 0x28},
+    {0x48, 0x3a},
+    {0x59, 0x88},
+    {0x5a, 0x88},
+    {0x5b, 0x44},
+    {0x5c, 0x67},
+    {0x5d, 0x49},
+    {0x5e, 0x0e},
+    {0x6c, 0x0a},
+    {0x6d, 0x55},
+    {0x6e, 0x11},
+    {0x6f, 0x9e},
+    {0x6a, 0x40}, // GGAIN
+    {0x01, 0x40}, // REG_BLUE
+    {0x02, 0x60}, // REG_RED
+    {0x13, 0xc7}, // REG_COM8
+    {0x58, 0x9e}, // MTXS
+    {0x3f, 0x00}, // REG_EDGE
+    {0x75, 0x05},
+    {0x4c, 0x00},
+    {0x77, 0x01},
+    {0x4b, 0x09},
+    {0xc9, 0x60},
+    {0x56, 0x40}, // REG_CONTRAS
+    {0x34, 0x11},
+    {0x3b, 0x12}, // REG_COM11
+    {0xa4, 0x82},
+    {0x96, 0x00},
+    {0x97, 0x30},
+    {0x98, 0x20},
+    {0x99, 0x30},
+    {0x9a, 0x84},
+    {0x9b, 0x29},
+    {0x9c, 0x03},
+    {0x9d, 0x4c},
+    {0x9e, 0x3f},
+    {0x78, 0x04},
+    {0x76, 0xe1}, // REG_REG76
+    {0x8c, 0x00}, // REG_RGB444
+    {0x04, 0x00}, // REG_COM1
+    {0x51, 0x00},
+    {0x19, 0x00}, // REG_VSTART
+    {0x1a, 0x7a}, // REG_VSTOP
+    {0x79, 0x01},
+    {0xc8, 0xf0},
+    {0x79, 0x0f},
+    {0xc8, 0x00},
+    {0x79, 0x10},
+    {0xc8, 0x7e},
+    {0x79, 0x0a},
+    {0xc8, 0x80},
+    {0x79, 0x0b},
+    {0xc8, 0x01},
+    {0x79, 0x0c},
+    {0xc8, 0x0f},
+    {0x79, 0x0d},
+    {0xc8, 0x20},
+    {0x79, 0x09},
+    {0xc8, 0x80},
+    {0x79, 0x02},
+    {0xc8, 0xc0},
+    {0x79, 0x03},
+    {0xc8, 0x40},
+    {0x79, 0x05},
+    {0xc8, 0x30},
+    {0x79, 0x26},
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded pixel format tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedRGB565 [] = {
+    {0x41, 0x08}, // REG_COM16
+    {0x12, 0x04}, // REG_COM7
+    {0x40, 0xd0}, // REG_COM15
+    {0x14, 0x6a}, // REG_COM9
+    {0x4f, 0xb3},
+    {0x50, 0xb3},
+    {0x52, 0x3d},
+    {0x53, 0xa7},
+    {0x54, 0xe4},
+    {0x3d, 0x40}, // REG_COM13
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded pixel format tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedBayerRGB [] = {
+    {0x41, 0x3d}, // REG_COM16
+    {0x12, 0x01}, // REG_COM7
+    {0x40, 0xc0}, // REG_COM15
+    {0x14, 0x18}, // REG_COM9
+    {0x4f, 0x80},
+    {0x50, 0x80},
+    {0x52, 0x22},
+    {0x53, 0x5e},
+    {0x54, 0x80},
+    {0x3d, 0x08}, // REG_COM13
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded pixel format tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedYUV422 [] = {
+    {0x41, 0x08}, // REG_COM16
+    {0x12, 0x00}, // REG_COM7
+    {0x40, 0xc0}, // REG_COM15
+    {0x14, 0x6a}, // REG_COM9
+    {0x4f, 0x80},
+    {0x50, 0x80},
+    {0x52, 0x22},
+    {0x53, 0x5e},
+    {0x54, 0x80},
+    {0x3d, 0x40}, // REG_COM13
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded resolution tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedVGA [] = {
+    {0x03, 0x08}, // REG_VREF
+    {0x17, 0x13}, // REG_HSTART
+    {0x18, 0x01}, // REG_HSTOP
+    {0x32, 0x34}, // REG_HREF
+    {0x0c, 0x00}, // REG_COM3
+    {0x3e, 0x00}, // REG_COM14
+    {0x72, 0x11}, // SCALING_DCWCTR
+    {0x73, 0xf0}, // SCALING_PCLK_DIV
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded resolution tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedQVGA [] = {
+    {0x03, 0x08}, // REG_VREF
+    {0x17, 0x15}, // REG_HSTART
+    {0x18, 0x04}, // REG_HSTOP
+    {0x32, 0x16}, // REG_HREF
+    {0x0c, 0x04}, // REG_COM3
+    {0x3e, 0x19}, // REG_COM14
+    {0x72, 0x11}, // SCALING_DCWCTR
+    {0x73, 0xf1}, // SCALING_PCLK_DIV
+    {0xff, 0xff},	/* END MARKER */
+};
+
+
+// Aligned with the other regsFolded resolution tables
+const PROGMEM RegisterData CameraOV7670Registers::regsFoldedQQVGA [] = {
+    {0x03, 0x00}, // REG_VREF
+    {0x17, 0x16}, // REG_HSTART
+    {0x18, 0x05}, // REG_HSTOP
+    {0x32, 0x36}, // REG_HREF
+    {0x0c, 0x04}, // REG_COM3
+    {0x3e, 0x1a}, // REG_COM14
+    {0x72, 0x22}, // SCALING_DCWCTR
+    {0x73, 0xf2}, // SCALING_PCLK_DIV
+    {0xff, 0xff},	/* END MARKER */
+};
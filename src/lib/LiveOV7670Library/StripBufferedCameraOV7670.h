@@ -0,0 +1,65 @@
+//
+// Multi-line luma buffer for block based coding.
+//
+
+#ifndef _STRIPBUFFEREDCAMERAOV7670_H
+#define _STRIPBUFFEREDCAMERAOV7670_H
+
+#include "CameraOV7670.h"
+
+
+
+// Keeps the Y bytes of the last stripLineCount lines of a YUV422 image.
+// Line y of the image goes to strip line y % stripLineCount, so after every
+// stripLineCount lines the strip holds one row of blocks.
+// The capture loop stores the bytes itself, so that it can use the time of the
+// dropped chroma bytes for sending.
+// 4 x 160 bytes (QQVGA) leave room for an output buffer in the SRAM of an Arduino Uno,
+// 4 x 320 bytes (QVGA) do not.
+template <uint16_t stripLineLength, uint8_t stripLineCount>
+class StripBufferedCameraOV7670 : public CameraOV7670 {
+
+protected:
+  static uint8_t stripBuffer[stripLineCount][stripLineLength];
+
+public:
+  StripBufferedCameraOV7670(Resolution resolution, PixelFormat format, uint8_t internalClockPreScaler, PLLMultiplier pllMultiplier = PLL_MULTIPLIER_BYPASS) :
+      CameraOV7670(resolution, format, internalClockPreScaler, pllMultiplier) {};
+
+  inline static constexpr uint16_t getStripLineLength() __attribute__((always_inline));
+  inline static constexpr uint8_t getStripLineCount() __attribute__((always_inline));
+  inline uint8_t * getStripLine(uint8_t stripLine) __attribute__((always_inline));
+
+};
+
+
+
+template <uint16_t stripLineLength, uint8_t stripLineCount>
+uint8_t StripBufferedCameraOV7670<stripLineLength, stripLineCount>::stripBuffer[stripLineCount][stripLineLength];
+
+
+
+
+template <uint16_t stripLineLength, uint8_t stripLineCount>
+constexpr uint16_t StripBufferedCameraOV7670<stripLineLength, stripLineCount>::getStripLineLength() {
+  return stripLineLength;
+}
+
+
+template <uint16_t stripLineLength, uint8_t stripLineCount>
+constexpr uint8_t StripBufferedCameraOV7670<stripLineLength, stripLineCount>::getStripLineCount() {
+  return stripLineCount;
+}
+
+
+template <uint16_t stripLineLength, uint8_t stripLineCount>
+uint8_t * StripBufferedCameraOV7670<stripLineLength, stripLineCount>::getStripLine(uint8_t stripLine) {
+  return stripBuffer[stripLine];
+}
+
+
+
+
+
+
+#endif //_STRIPBUFFEREDCAMERAOV7670_H
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+#
+# Generates the host table for the tokenized debug messages.
+#
+# DEBUG_LOG("format", arguments...) in the Arduino sources sends only the
+# CRC-16 of the format string and the raw argument bytes (COMMAND_DEBUG_LOG).
+# This script finds the DEBUG_LOG calls, computes the same ids as
+# debugLogCrc16 in src/LiveOV7670/DebugLog.h and writes them to
+# tools/debug_log_table.json. Two format strings with the same id stop the
+# build, since the host could not tell them apart.
+#
+# expand(table, payload) turns the bytes after the command code back into
+# the message and can be imported by the host tools.
+#
+# Usage:
+#   python3 tools/debug_log_table.py
+# or from platformio.ini:
+#   extra_scripts = pre:../tools/debug_log_table.py
+#
+# Output: tools/debug_log_table.json
+#
+
+import json
+import os
+import re
+import struct
+import sys
+
+
+SOURCE_EXTENSIONS = (".cpp", ".h", ".ino")
+OUTPUT_FILE = "debug_log_table.json"
+
+DEBUG_LOG_CALL = re.compile(r'\bDEBUG_LOG\s*\(\s*"((?:[^"\\]|\\.)*)"')
+
+# printf conversions and their argument size on AVR (int is 16-bit)
+CONVERSION = re.compile(r"%(hh|l)?([diuxX])")
+ARGUMENT_FORMATS = {
+    ("hh", "d"): "<b", ("hh", "i"): "<b", ("hh", "u"): "<B", ("hh", "x"): "<B", ("hh", "X"): "<B",
+    ("", "d"): "<h", ("", "i"): "<h", ("", "u"): "<H", ("", "x"): "<H", ("", "X"): "<H",
+    ("l", "d"): "<l", ("l", "i"): "<l", ("l", "u"): "<L", ("l", "x"): "<L", ("l", "X"): "<L",
+}
+
+
+# CRC-16/CCITT-FALSE, same as debugLogCrc16
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def unescape(literal):
+    return literal.encode("latin-1").decode("unicode_escape")
+
+
+def find_messages(source_dir):
+    messages = {}
+    for root, _, files in os.walk(source_dir):
+        for file_name in sorted(files):
+            if not file_name.endswith(SOURCE_EXTENSIONS):
+                continue
+            path = os.path.join(root, file_name)
+            with open(path) as f:
+                text = f.read()
+            for match in DEBUG_LOG_CALL.finditer(text):
+                # Usage examples in comments are not messages
+                if "//" in text[text.rfind("\n", 0, match.start()) + 1:match.start()]:
+                    continue
+                message_format = unescape(match.group(1))
+                message_id = crc16(message_format.encode("latin-1"))
+                location = os.path.relpath(path, source_dir)
+                known = messages.get(message_id)
+                if known is not None and known["format"] != message_format:
+                    sys.exit("DEBUG_LOG id 0x%04X of \"%s\" (%s) is the same as \"%s\" (%s)"
+                             % (message_id, message_format, location, known["format"], known["file"]))
+                if known is None:
+                    messages[message_id] = {"format": message_format, "file": location}
+    return messages
+
+
+def generate(source_dir, output_path):
+    messages = find_messages(source_dir)
+    table = {"0x%04X" % message_id: messages[message_id] for message_id in sorted(messages)}
+    content = json.dumps(table, indent=2, sort_keys=True) + "\n"
+    if os.path.exists(output_path):
+        with open(output_path) as f:
+            if f.read() == content:
+                return
+    with open(output_path, "w") as f:
+        f.write(content)
+    print("Generated " + output_path)
+
+
+# payload: id and argument bytes of a COMMAND_DEBUG_LOG command
+def expand(table, payload):
+    message_id = payload[0] | (payload[1] << 8)
+    entry = table.get("0x%04X" % message_id)
+    if entry is None:
+        return "unknown debug message 0x%04X %s" % (message_id, payload[2:].hex())
+    message_format = entry["format"]
+    arguments = []
+    offset = 2
+    for length, conversion in CONVERSION.findall(message_format):
+        argument_format = ARGUMENT_FORMATS[(length, conversion)]
+        arguments.append(struct.unpack_from(argument_format, payload, offset)[0])
+        offset += struct.calcsize(argument_format)
+    return CONVERSION.sub(lambda m: "%" + m.group(2), message_format) % tuple(arguments)
+
+
+try:
+    Import("env")  # PlatformIO extra script
+    generate(env.subst("$PROJECT_SRC_DIR"),
+             os.path.join(env.subst("$PROJECT_DIR"), "..", "tools", OUTPUT_FILE))
+except NameError:
+    if __name__ == "__main__":
+        tools_dir = os.path.dirname(os.path.abspath(__file__))
+        generate(os.path.join(tools_dir, "..", "src", "LiveOV7670"), os.path.join(tools_dir, OUTPUT_FILE))
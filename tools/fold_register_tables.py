@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+#
+# Folds the layered OV7670 register tables into deduplicated tables.
+#
+# CameraOV7670::setUpCamera used to apply regsDefault, then a pixel format
+# table and then a resolution table. Many registers were written more than
+# once on that path. This script computes the final register state of every
+# (pixel format, resolution) combination and splits it into:
+#
+#   regsFoldedCommon             registers that end up the same in every combination
+#   regsFolded<PixelFormat>      registers that only depend on the pixel format
+#   regsFolded<Resolution>       registers that only depend on the resolution
+#
+# Every register is written once. All pixel format tables list the same
+# registers in the same order, and so do the resolution tables. Switching
+# between two combinations is a lockstep compare of the aligned tables
+# (CameraOV7670Registers::setRegisterChanges), so no separate diff tables
+# are needed.
+#
+# Usage:
+#   python3 tools/fold_register_tables.py
+# or from platformio.ini:
+#   extra_scripts = pre:../tools/fold_register_tables.py
+#
+# Output: src/lib/LiveOV7670Library/CameraOV7670RegistersFolded.cpp
+#
+
+import os
+import re
+import sys
+
+
+PIXEL_FORMATS = [
+    ("RGB565", "CameraOV7670RegistersRGB565.cpp", "regsRGB565"),
+    ("BayerRGB", "CameraOV7670RegistersBayerRGB.cpp", "regsBayerRGB"),
+    ("YUV422", "CameraOV7670RegistersYUV422.cpp", "regsYUV422"),
+]
+
+RESOLUTIONS = [
+    ("VGA", "CameraOV7670RegistersVGA.cpp", "regsVGA"),
+    ("QVGA", "CameraOV7670RegistersQVGA.cpp", "regsQVGA"),
+    ("QQVGA", "CameraOV7670RegistersQQVGA.cpp", "regsQQVGA"),
+]
+
+DEFAULT_TABLE = ("CameraOV7670RegistersDefault.cpp", "regsDefault")
+OUTPUT_FILE = "CameraOV7670RegistersFolded.cpp"
+
+REG_COM7 = 0x12
+COM7_RESET = 0x80
+END_MARKER = 0xFF
+
+# 0x79 selects an internal register and 0xC8 writes it.
+# These writes only make sense as an ordered sequence and are never folded.
+SEQUENCE_REGISTERS = (0x79, 0xC8)
+
+# Values after COM7 reset for registers that are written in some
+# combinations and not in others.
+RESET_VALUES = {
+    0x04: 0x00,  # REG_COM1
+    0x40: 0xC0,  # REG_COM15
+    0x8C: 0x00,  # REG_RGB444
+}
+
+
+def strip_comments(text):
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    return re.sub(r"//[^\n]*", "", text)
+
+
+def evaluate(expression, symbols):
+    expression = expression.replace("CameraOV7670Registers::", "").strip()
+    return int(eval(expression, {"__builtins__": {}}, symbols)) & 0xFF
+
+
+def read_definitions(library_dir):
+    symbols = {}
+    names = {}
+    with open(os.path.join(library_dir, "CameraOV7670RegisterDefinitions.h")) as f:
+        text = strip_comments(f.read())
+    for name, value in re.findall(r"#define\s+(\w+)\s+(0x[0-9a-fA-F]+|\d+)\s*$", text, re.M):
+        symbols[name] = int(value, 0)
+        if name.startswith("REG_") or name in ("DBLV", "GGAIN", "MTXS", "SCALING_DCWCTR", "SCALING_PCLK_DIV"):
+            names.setdefault(int(value, 0), name)
+    return symbols, names
+
+
+def read_table(library_dir, file_name, table_name, definitions):
+    with open(os.path.join(library_dir, file_name)) as f:
+        text = strip_comments(f.read())
+
+    symbols = dict(definitions)
+    for name, expression in re.findall(r"const\s+uint(?:8|16)_t\s+(?:CameraOV7670Registers::)?(\w+)\s*=\s*([^;]+);", text):
+        symbols[name] = eval(expression.replace("CameraOV7670Registers::", ""), {"__builtins__": {}}, symbols)
+
+    body = re.search(table_name + r"\s*\[\s*\]\s*=\s*\{(.*?)\};", text, re.S)
+    if not body:
+        sys.exit("%s not found in %s" % (table_name, file_name))
+
+    table = []
+    for addr, val in re.findall(r"\{([^{},]+),([^{},]+)\}", body.group(1)):
+        entry = (evaluate(addr, symbols), evaluate(val, symbols))
+        if entry[0] == END_MARKER:
+            break
+        table.append(entry)
+    return table
+
+
+def final_values(writes):
+    values = {}
+    for addr, val in writes:
+        if addr == REG_COM7 and (val & COM7_RESET):
+            # resetSettings() has already reset the camera
+            continue
+        if addr not in SEQUENCE_REGISTERS:
+            values[addr] = val
+    return values
+
+
+# Each register goes to the position of its last write, so sequences like
+# "COM8 AGC/AEC off, GAIN = 0, AECH = 0, COM8 AGC/AEC on" keep their order
+# with the final value written after the registers it depends on.
+def write_order(writes):
+    order = []
+    for addr, _ in writes:
+        if addr not in SEQUENCE_REGISTERS:
+            if addr in order:
+                order.remove(addr)
+            order.append(addr)
+    return order
+
+
+def format_table(name, table, names, comment):
+    lines = ["// " + comment, "const PROGMEM RegisterData CameraOV7670Registers::%s [] = {" % name]
+    for addr, val in table:
+        entry = "    {0x%02x, 0x%02x}," % (addr, val)
+        if addr in names:
+            entry += " // " + names[addr]
+        lines.append(entry)
+    lines.append("    {0xff, 0xff},\t/* END MARKER */")
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def generate(library_dir):
+    definitions, names = read_definitions(library_dir)
+    default_table = read_table(library_dir, DEFAULT_TABLE[0], DEFAULT_TABLE[1], definitions)
+    format_tables = [read_table(library_dir, f, t, definitions) for _, f, t in PIXEL_FORMATS]
+    resolution_tables = [read_table(library_dir, f, t, definitions) for _, f, t in RESOLUTIONS]
+
+    sequence = [e for e in default_table if e[0] in SEQUENCE_REGISTERS]
+    for table in format_tables + resolution_tables:
+        if any(e[0] in SEQUENCE_REGISTERS for e in table):
+            sys.exit("0x79/0xc8 sequences are only supported in regsDefault")
+
+    # Final register state of every combination
+    states = {}
+    layered_write_count = {}
+    for f, format_table_data in enumerate(format_tables):
+        for r, resolution_table in enumerate(resolution_tables):
+            writes = default_table + format_table_data + resolution_table
+            states[(f, r)] = final_values(writes)
+            layered_write_count[(f, r)] = len(writes)
+
+    order = write_order(default_table + sum(format_tables, []) + sum(resolution_tables, []))
+    for state in states.values():
+        for addr in order:
+            if addr not in state:
+                if addr not in RESET_VALUES:
+                    sys.exit("Reset value of register 0x%02x is unknown, add it to RESET_VALUES" % addr)
+                state[addr] = RESET_VALUES[addr]
+
+    common = []
+    by_format = []
+    by_resolution = []
+    for addr in order:
+        values = dict((key, state[addr]) for key, state in states.items())
+        if len(set(values.values())) == 1:
+            common.append(addr)
+        elif all(values[(f, 0)] == values[(f, r)] for f, r in values):
+            by_format.append(addr)
+        elif all(values[(0, r)] == values[(f, r)] for f, r in values):
+            by_resolution.append(addr)
+        else:
+            sys.exit("Register 0x%02x depends on both pixel format and resolution" % addr)
+
+    any_state = states[(0, 0)]
+    out = [
+        "//",
+        "// Generated by tools/fold_register_tables.py from regsDefault, the pixel format",
+        "// tables and the resolution tables. Do not edit, edit those and regenerate.",
+        "//",
+        "// Setting up a camera mode writes regsFoldedCommon, then one pixel format table",
+        "// and then one resolution table. Each register is written once.",
+        "// The layered tables wrote %d to %d registers per mode, the folded tables write %d." % (
+            min(layered_write_count.values()), max(layered_write_count.values()),
+            len(common) + len(sequence) + len(by_format) + len(by_resolution)),
+        "//",
+        "",
+        "#include \"CameraOV7670Registers.h\"",
+        "",
+        "",
+        format_table("regsFoldedCommon", [(a, any_state[a]) for a in common] + sequence, names,
+                     "Same in every pixel format and resolution"),
+        "",
+        "",
+    ]
+
+    for f, (format_name, _, _) in enumerate(PIXEL_FORMATS):
+        out.append(format_table("regsFolded" + format_name, [(a, states[(f, 0)][a]) for a in by_format], names,
+                                "Aligned with the other regsFolded pixel format tables"))
+        out.append("")
+        out.append("")
+
+    for r, (resolution_name, _, _) in enumerate(RESOLUTIONS):
+        out.append(format_table("regsFolded" + resolution_name, [(a, states[(0, r)][a]) for a in by_resolution], names,
+                                "Aligned with the other regsFolded resolution tables"))
+        out.append("")
+        out.append("")
+
+    content = "\n".join(out).rstrip("\n") + "\n"
+    output_path = os.path.normpath(os.path.join(library_dir, OUTPUT_FILE))
+    if os.path.exists(output_path):
+        with open(output_path) as f:
+            if f.read() == content:
+                return
+    with open(output_path, "w") as f:
+        f.write(content)
+    print("Generated " + output_path)
+
+
+try:
+    Import("env")  # PlatformIO extra script
+    generate(os.path.join(env.subst("$PROJECT_DIR"), "lib", "LiveOV7670Library"))
+except NameError:
+    if __name__ == "__main__":
+        generate(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              "..", "src", "lib", "LiveOV7670Library"))
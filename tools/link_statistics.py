@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+#
+# Loss and corruption statistics of the camera UART link.
+#
+# With UART_LINE_CRC 1 in src/LiveOV7670/TestUART.cpp every line of the
+# buffered modes is followed by COMMAND_LINE_CRC (CRC-8 of the pixel bytes
+# of the line) and every frame ends with COMMAND_FRAME_END (CRC-16 of the
+# line CRCs). This script checks a recording of the link against them and
+# reports the error rates, one report per link. A link whose line error
+# rate keeps growing with the cable length needs a lower baud rate.
+#
+# Usage:
+#   python3 tools/link_statistics.py capture1.bin [capture2.bin ...]
+# or live from a serial port (needs pyserial):
+#   python3 tools/link_statistics.py --port /dev/ttyUSB0 --baud 1000000 --seconds 60
+#
+# A capture is the raw byte stream of the port, for example from
+#   stty -F /dev/ttyUSB0 1000000 raw && cat /dev/ttyUSB0 > capture1.bin
+#
+
+import argparse
+import sys
+import time
+
+
+COMMAND_FRAME_HEADER = 0x22
+COMMAND_LINE_CRC = 0x26
+COMMAND_FRAME_END = 0x27
+
+
+# CRC-8/SMBUS, same as crc8Table
+def crc8_update(crc, byte):
+    crc ^= byte
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+CRC8_TABLE = [crc8_update(0, i) for i in range(256)]
+
+
+# CRC-16/XMODEM, same as _crc_xmodem_update
+def crc16_update(crc, byte):
+    crc ^= byte << 8
+    for _ in range(8):
+        crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+class LinkStatistics:
+
+    def __init__(self, name):
+        self.name = name
+        self.bytes = 0
+        self.commands = 0
+        self.command_errors = 0
+        self.frames = 0
+        self.frame_errors = 0
+        self.frames_incomplete = 0
+        self.frames_lost = 0
+        self.lines = 0
+        self.line_errors = 0
+        self.lines_lost = 0
+        self.sequence = None
+        self.is_frame_open = False
+        self.line_crc = 0
+        self.line_crcs = []
+        self._state = None
+        self._length = 0
+        self._command = bytearray()
+
+    # Feeds the bytes of the link, commands may be split between calls
+    def feed(self, data):
+        for byte in data:
+            self.bytes += 1
+            self._parse(byte)
+
+    def _parse(self, byte):
+        state = self._state
+        if state is None:
+            if byte == 0x00:
+                self._state = "length"
+            else:
+                self.line_crc = CRC8_TABLE[self.line_crc ^ byte]
+        elif state == "length":
+            self._length = byte
+            self._command = bytearray()
+            self._state = "command" if byte > 0 else None
+        elif state == "command":
+            self._command.append(byte)
+            if len(self._command) == self._length:
+                self._state = "checksum"
+        else:
+            self._state = None
+            checksum = 0
+            for command_byte in self._command:
+                checksum ^= command_byte
+            self.commands += 1
+            if checksum != byte:
+                self.command_errors += 1
+            else:
+                self._process_command(self._command)
+            # Pixel bytes start again after every command
+            self.line_crc = 0
+
+    def _process_command(self, command):
+        code = command[0]
+        if code == COMMAND_FRAME_HEADER and len(command) >= 3:
+            sequence = command[1] | (command[2] << 8)
+            if self.is_frame_open:
+                self.frames_incomplete += 1
+            if self.sequence is not None:
+                self.frames_lost += (sequence - self.sequence - 1) & 0xFFFF
+            self.sequence = sequence
+            self.is_frame_open = True
+            self.line_crcs = []
+        elif code == COMMAND_LINE_CRC and len(command) == 2:
+            self.lines += 1
+            if command[1] != self.line_crc:
+                self.line_errors += 1
+            self.line_crcs.append(command[1])
+        elif code == COMMAND_FRAME_END and len(command) == 7:
+            line_count = command[3] | (command[4] << 8)
+            frame_crc = command[5] | (command[6] << 8)
+            self.is_frame_open = False
+            if line_count == 0:
+                return
+            crc = 0
+            for line_crc in self.line_crcs:
+                crc = crc16_update(crc, line_crc)
+            self.frames += 1
+            self.lines_lost += max(line_count - len(self.line_crcs), 0)
+            if crc != frame_crc or line_count != len(self.line_crcs):
+                self.frame_errors += 1
+
+    def report(self):
+        def rate(count, total):
+            return "%d / %d (%.4f%%)" % (count, total, 100.0 * count / total if total else 0.0)
+
+        print("link " + self.name)
+        print("  bytes            %d" % self.bytes)
+        print("  command errors   " + rate(self.command_errors, self.commands))
+        print("  frame errors     " + rate(self.frame_errors, self.frames))
+        print("  frames lost      %d" % self.frames_lost)
+        print("  frames cut off   %d" % self.frames_incomplete)
+        print("  line errors      " + rate(self.line_errors, self.lines))
+        print("  lines lost       %d" % self.lines_lost)
+        if self.frames == 0:
+            print("  no checked frames, is UART_LINE_CRC enabled?")
+
+
+def read_port(port, baud, seconds):
+    import serial  # pyserial, only needed for live links
+    statistics = LinkStatistics(port)
+    with serial.Serial(port, baud, timeout=0.1) as link:
+        end = time.time() + seconds
+        while time.time() < end:
+            statistics.feed(link.read(4096))
+    return statistics
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Loss and corruption statistics of the camera UART link")
+    parser.add_argument("captures", nargs="*", help="raw recordings of the link, one per link")
+    parser.add_argument("--port", help="serial port to read live instead")
+    parser.add_argument("--baud", type=int, default=1000000)
+    parser.add_argument("--seconds", type=float, default=60)
+    args = parser.parse_args()
+
+    if not args.captures and not args.port:
+        parser.error("give capture files or --port")
+
+    links = []
+    if args.port:
+        links.append(read_port(args.port, args.baud, args.seconds))
+    for capture in args.captures:
+        statistics = LinkStatistics(capture)
+        with open(capture, "rb") as f:
+            statistics.feed(f.read())
+        links.append(statistics)
+
+    for statistics in links:
+        statistics.report()
+    return 0 if all(statistics.frame_errors == 0 and statistics.line_errors == 0 for statistics in links) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())